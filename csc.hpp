@@ -1,20 +1,51 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
 #include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
 #include <expected>
 #include <filesystem>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
 #include <cstring>
 #include <system_error>
 
 #ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+    #include <sys/stat.h>
     #include <windows.h>
 #else
     #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <dirent.h>
+    #include <signal.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <sys/wait.h>
     #include <unistd.h>
+
+extern char** environ;
 #endif // _Win32
 
 namespace csc {
@@ -36,7 +67,7 @@ enum class System {
 
 inline bool is_terminal() {
 #ifdef _WIN32
-    return GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) == FILE_TYPE_CHAR;
+    return GetFileType(GetStdHandle(STD_ERROR_HANDLE)) == FILE_TYPE_CHAR;
 #else
     return isatty(fileno(stderr));
 #endif // _WIN32
@@ -58,17 +89,211 @@ inline Result<std::vector<char>> ReadFile(const Path& path) {
     file.close();
     return buffer;
 }
+
+// calls `fn` with every line of `path` minus its '\n', false when the file can't be read
+template <typename Fn>
+inline bool read_lines(const Path& path, Fn&& fn) {
+    Result<std::vector<char>> data = ReadFile(path);
+    if (!data) return false;
+
+    string_view content(data->data(), data->size());
+    while (!content.empty()) {
+        size_t end = content.find('\n');
+        fn(content.substr(0, end));
+        content.remove_prefix(end == string_view::npos ? content.size() : end + 1);
+    }
+    return true;
+}
+
+// written to a temp file and renamed over `path`, a reader never sees half a file
+inline bool write_file(const Path& path, string_view content) {
+    std::error_code ec;
+    if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path(), ec);
+    Path temp = path;
+    temp += ".tmp";
+    {
+        std::ofstream file(temp, std::ios::binary);
+        if (!file || !file.write(content.data(), content.size())) return false;
+    }
+    std::filesystem::rename(temp, path, ec);
+    return !ec;
+}
+
+struct FileStat {
+    bool     exists = false;
+    int64_t  mtime  = 0; // nanoseconds
+    uint64_t size   = 0;
+
+    bool operator==(const FileStat&) const = default;
+};
+
+// one syscall, no exceptions, a missing file is not an error
+inline FileStat stat_file(const Path& path) {
+    FileStat info;
+#ifdef _WIN32
+    std::error_code ec;
+    auto            time = std::filesystem::last_write_time(path, ec);
+    if (ec) return info;
+    info.exists = true;
+    info.mtime  = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    info.size   = std::filesystem::is_regular_file(path, ec) ? std::filesystem::file_size(path, ec) : 0;
+#else
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return info;
+    info.exists = true;
+    #ifdef __APPLE__
+    info.mtime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+    #else
+    info.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    #endif // __APPLE__
+    info.size = S_ISREG(st.st_mode) ? uint64_t(st.st_size) : 0;
+#endif // _WIN32
+    return info;
+}
+
+struct DirListing {
+    int64_t             mtime = 0;
+    std::vector<string> files;
+    std::vector<string> dirs;
+};
+
+// entry names of one directory, symlinks to directories are not followed
+inline DirListing read_dir(const Dir& dir) {
+    DirListing listing;
+#if defined __linux__
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return listing;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) listing.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+    alignas(8) char buffer[32768];
+    while (true) {
+        long n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (n <= 0) break;
+        for (long offset = 0; offset < n;) {
+            // struct linux_dirent64: ino64, off64, reclen, type, name
+            char*          entry  = buffer + offset;
+            unsigned short reclen = 0;
+            std::memcpy(&reclen, entry + 16, sizeof(reclen));
+            unsigned char type = (unsigned char)entry[18];
+            const char*   name = entry + 19;
+            offset += reclen;
+
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                struct stat info;
+                if (fstatat(fd, name, &info, type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) != 0) continue;
+                if (S_ISREG(info.st_mode)) type = DT_REG;
+                else if (S_ISDIR(info.st_mode) && type != DT_LNK) type = DT_DIR;
+                else continue;
+            }
+            if (type == DT_DIR) {
+                listing.dirs.emplace_back(name);
+            } else if (type == DT_REG) {
+                listing.files.emplace_back(name);
+            }
+        }
+    }
+    close(fd);
+#else
+    std::error_code ec;
+    listing.mtime = stat_file(dir).mtime;
+    for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        if (it->is_symlink(ec) ? false : it->is_directory(ec)) {
+            listing.dirs.push_back(it->path().filename().string());
+        } else if (it->is_regular_file(ec)) {
+            listing.files.push_back(it->path().filename().string());
+        }
+    }
+#endif // __linux__
+    return listing;
+}
+
+// first executable called `name` in PATH
+inline std::optional<Path> find_program(string_view name) {
+    const char* env = std::getenv("PATH");
+    if (!env) return std::nullopt;
+#ifdef _WIN32
+    constexpr char separator = ';';
+    string         file      = string(name) + ".exe";
+#else
+    constexpr char separator = ':';
+    string         file(name);
+#endif // _WIN32
+    string_view paths = env;
+    while (true) {
+        size_t      end = paths.find(separator);
+        string_view dir = paths.substr(0, end);
+        Path        exe = (dir.empty() ? Path(".") : Path(dir)) / file;
+#ifdef _WIN32
+        if (stat_file(exe).exists) return exe;
+#else
+        if (access(exe.c_str(), X_OK) == 0 && stat_file(exe).size > 0) return exe;
+#endif // _WIN32
+        if (end == string_view::npos) break;
+        paths.remove_prefix(end + 1);
+    }
+    return std::nullopt;
+}
 } // namespace OS
 
+// FNV-1a, stable across runs so it can be persisted
+inline uint64_t hash_bytes(string_view data, uint64_t hash = 14695981039346656037ull) {
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t hash_combine(uint64_t hash, uint64_t value) {
+    return hash_bytes(string_view(reinterpret_cast<const char*>(&value), sizeof(value)), hash);
+}
+
+// append `str` as a quoted json string
+inline void escape_json(string& out, string_view str) {
+    out.push_back('"');
+    for (unsigned char c : str) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    out += buffer;
+                } else {
+                    out.push_back(char(c));
+                }
+        }
+    }
+    out.push_back('"');
+}
+
 namespace predefine {
 #if defined __clang__
 static string current_compiler = "clang++";
-#elif define __GUN__
-static string current_compiler = "gcc";
+#elif defined __GNUC__
+static string current_compiler = "g++";
+#else
+static string current_compiler = "c++";
 #endif // __clang__
 
 } // namespace predefine
 
+// records below this level are compiled out, 0 keeps `code` logging
+#ifndef CSC_LOG_MIN_LEVEL
+    #ifdef NDEBUG
+        #define CSC_LOG_MIN_LEVEL 1
+    #else
+        #define CSC_LOG_MIN_LEVEL 0
+    #endif // NDEBUG
+#endif     // CSC_LOG_MIN_LEVEL
+
 namespace log_impl {
 enum Level {
     code,
@@ -100,30 +325,110 @@ inline string get_ansi_color(Color color) {
     }
 }
 
-inline string colorize_str(const std::string_view str, Color color) {
-    if (OS::is_terminal()) {
-        string result;
-        result.reserve(str.size() + 16);
-        result += "\x1b[";
-        result += get_ansi_color(color);
-        result += "m";
-        result += str;
-        result += "\x1b[0m";
-        return result;
-    } else {
-        return string(str);
+// decided once per process: CSC_LOG_LEVEL, NO_COLOR and CSC_LOG_JSON
+struct Config {
+    bool               color = false;
+    std::atomic<Level> level = Level::code;
+    std::atomic<int>   json  = -1; // fd of the json lines sink, -1 when off
+    int                sink  = -1; // the one fd ever handed to writers, reused by set_log_json
+    std::mutex         sink_lock;
+};
+
+inline Level parse_level(string_view name) {
+    if (name == "code") return Level::code;
+    if (name == "warn") return Level::warn;
+    if (name == "erro") return Level::erro;
+    return Level::info;
+}
+
+inline int open_sink(const Path& path) {
+#ifdef _WIN32
+    return _wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif // _WIN32
+}
+
+inline Config& config() {
+    static Config cfg;
+    static bool   init = [] {
+        const char* no_color = std::getenv("NO_COLOR");
+        cfg.color            = OS::is_terminal() && !(no_color && *no_color);
+        if (const char* level = std::getenv("CSC_LOG_LEVEL")) cfg.level = parse_level(level);
+        if (const char* json = std::getenv("CSC_LOG_JSON")) cfg.json = cfg.sink = open_sink(json);
+        return true;
+    }();
+    (void)init;
+    return cfg;
+}
+
+// the whole record goes out in one call, so records from concurrent jobs never interleave
+inline void write_record(int fd, const string& record) {
+#ifdef _WIN32
+    _write(fd, record.data(), unsigned(record.size()));
+#else
+    const char* data = record.data();
+    size_t      size = record.size();
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        data += n;
+        size -= size_t(n);
+    }
+#endif // _WIN32
+}
+
+// printf into `out`, reusing its capacity
+inline void append_vformat(string& out, const char* fmt, va_list list) {
+    size_t  offset = out.size();
+    va_list copy;
+    va_copy(copy, list);
+    out.resize(std::max(out.capacity(), offset + 256));
+    int n = std::vsnprintf(out.data() + offset, out.size() - offset, fmt, copy);
+    va_end(copy);
+    if (n < 0) {
+        out.resize(offset);
+        return;
     }
+    if (size_t(n) >= out.size() - offset) {
+        out.resize(offset + n + 1);
+        std::vsnprintf(out.data() + offset, n + 1, fmt, list);
+    }
+    out.resize(offset + n);
 }
 
-inline void log_color(Level level, const string& fmt, va_list list) {
-    switch (level) {
-        case Level::code: std::fprintf(stderr, "%s", colorize_str("[code] ", Color::blue).c_str()); break;
-        case Level::info: std::fprintf(stderr, "%s", colorize_str("[info] ", Color::green).c_str()); break;
-        case Level::warn: std::fprintf(stderr, "%s", colorize_str("[warn] ", Color::yellow).c_str()); break;
-        case Level::erro: std::fprintf(stderr, "%s", colorize_str("[erro] ", Color::red).c_str()); break;
+inline void log_color(Level level, string_view fmt, va_list list) {
+    Config& cfg = config();
+    if (level < cfg.level.load(std::memory_order_relaxed)) return;
+
+    static constexpr string_view plain[] = {"[code] ", "[info] ", "[warn] ", "[erro] "};
+    static constexpr string_view color[] = {"\x1b[34m[code] \x1b[0m", "\x1b[32m[info] \x1b[0m", "\x1b[33m[warn] \x1b[0m", "\x1b[31m[erro] \x1b[0m"};
+
+    // vsnprintf needs a terminated format, string_view does not promise one
+    thread_local string format;
+    thread_local string record;
+    format.assign(fmt);
+
+    record.assign(cfg.color ? color[level] : plain[level]);
+    size_t message = record.size();
+    append_vformat(record, format.c_str(), list);
+
+    int json = cfg.json.load(std::memory_order_relaxed);
+    if (json >= 0) {
+        thread_local string line;
+        auto                now = std::chrono::system_clock::now().time_since_epoch();
+        line                    = "{\"time\":" + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+        line += ",\"level\":\"";
+        line += plain[level].substr(1, 4);
+        line += "\",\"msg\":";
+        escape_json(line, string_view(record).substr(message));
+        line += "}\n";
+        write_record(json, line);
     }
-    std::vfprintf(stderr, fmt.c_str(), list);
-    std::fprintf(stderr, "\n");
+
+    record.push_back('\n');
+    write_record(2, record);
 }
 
 #define CODE log_impl::Level::code
@@ -132,52 +437,97 @@ inline void log_color(Level level, const string& fmt, va_list list) {
 #define ERRO log_impl::Level::erro
 } // namespace log_impl
 
+inline void set_log_level(log_impl::Level level) {
+    log_impl::config().level = level;
+}
+
+// also append every record as a json line to `path`, an empty path turns the sink off
+inline bool set_log_json(const Path& path) {
+    log_impl::Config& cfg = log_impl::config();
+    std::lock_guard   lock(cfg.sink_lock);
+    if (path.empty()) {
+        cfg.json = -1;
+        return true;
+    }
+    int fd = log_impl::open_sink(path);
+    if (fd < 0) return false;
+    if (cfg.sink < 0) {
+        cfg.sink = fd;
+    } else {
+        // a writer may hold the old fd number, so swap the file behind it instead of closing it
+#ifdef _WIN32
+        int moved = _dup2(fd, cfg.sink);
+        _close(fd);
+#else
+        int moved = dup2(fd, cfg.sink);
+        close(fd);
+#endif // _WIN32
+        if (moved < 0) return false;
+    }
+    cfg.json = cfg.sink;
+    return true;
+}
+
 inline void log(log_impl::Level level, string_view fmt, ...) {
+    if (level < CSC_LOG_MIN_LEVEL) return;
     va_list list;
     va_start(list, fmt);
-    log_color(level, string(fmt), list);
+    log_color(level, fmt, list);
     va_end(list);
 }
 
 inline void logc(string_view fmt, ...) {
+#if CSC_LOG_MIN_LEVEL <= 0
     va_list list;
     va_start(list, fmt);
-    log_color(CODE, string(fmt), list);
+    log_color(CODE, fmt, list);
     va_end(list);
+#endif // CSC_LOG_MIN_LEVEL
 }
 
 inline void logi(string_view fmt, ...) {
     va_list list;
     va_start(list, fmt);
-    log_color(INFO, string(fmt), list);
+    log_color(INFO, fmt, list);
     va_end(list);
 }
 
 inline void logw(string_view fmt, ...) {
     va_list list;
     va_start(list, fmt);
-    log_color(WARN, string(fmt), list);
+    log_color(WARN, fmt, list);
     va_end(list);
 }
 
 inline void loge(string_view fmt, ...) {
     va_list list;
     va_start(list, fmt);
-    log_color(ERRO, string(fmt), list);
+    log_color(ERRO, fmt, list);
     va_end(list);
 }
 
-inline bool is_outdated(const Path& output, const std::vector<Path>& inputs) {
-    using std::filesystem::last_write_time;
-    BOOL bSuccess;
+// stats of sources and headers shared by every target and variant of one build,
+// outputs change during the build and must not go through it
+class StatCache {
+public:
+    const OS::FileStat& get(const Path& path) {
+        auto [it, inserted] = stats.try_emplace(path.native());
+        if (inserted) it->second = OS::stat_file(path);
+        return it->second;
+    }
+
+private:
+    std::unordered_map<Path::string_type, OS::FileStat> stats;
+};
 
-    if (!std::filesystem::exists(output)) { return true; }
-    auto ouput_time = last_write_time(output);
+inline bool is_outdated(const Path& output, const std::vector<Path>& inputs, StatCache* stats = nullptr) {
+    OS::FileStat output_info = OS::stat_file(output);
+    if (!output_info.exists) { return true; }
 
     for (size_t i = 0; i < inputs.size(); ++i) {
-        auto input_time = last_write_time(inputs[i]);
+        OS::FileStat input_info = stats ? stats->get(inputs[i]) : OS::stat_file(inputs[i]);
 
-        if (input_time > ouput_time) {
+        if (!input_info.exists || input_info.mtime > output_info.mtime) {
             return true;
         }
     }
@@ -271,8 +621,10 @@ inline std::optional<DepInfo> parse_dep_file(const Path& dep_path) {
 
 class Unit {
 public:
-    Path path;
-    Path obj;
+    Path   path;
+    Path   obj;
+    double seconds = 0;     // of its last compile in this process, 0 when not compiled
+    bool   failed  = false; // its last compile in this process reported an error
 
     Unit(Path path) : path(path) {};
 
@@ -288,86 +640,298 @@ public:
     }
 };
 
+using OptionBlock = std::shared_ptr<const std::vector<string>>;
+
+inline OptionBlock make_option_block(std::vector<string> options) {
+    return std::make_shared<const std::vector<string>>(std::move(options));
+}
+
+namespace OS {
+// bytes the argv of a new process may take, minus what the environment already uses
+inline size_t arg_max() {
+    static const size_t limit = [] {
+#ifdef _WIN32
+        return size_t(32767);
+#else
+        long max = sysconf(_SC_ARG_MAX);
+        if (max <= 0) max = 131072;
+        size_t env = 0;
+        for (char** e = environ; *e; ++e) {
+            env += std::strlen(*e) + 1 + sizeof(char*);
+        }
+        size_t margin = 4096 + env;
+        return size_t(max) > margin ? size_t(max) - margin : 0;
+#endif // _WIN32
+    }();
+    return limit;
+}
+
+// linux rejects any single argument longer than MAX_ARG_STRLEN
+constexpr size_t arg_strlen_max = 32 * 4096;
+} // namespace OS
+
+// bump allocator for argument strings, pointers stay valid when the arena is moved
+class Arena {
+public:
+    Arena() = default;
+
+    // the source stays usable, its next store starts a new chunk
+    Arena(Arena&& other) noexcept :
+    chunks(std::move(other.chunks)),
+    used(std::exchange(other.used, 0)),
+    capacity(std::exchange(other.capacity, 0)) {};
+
+    Arena& operator=(Arena&& other) noexcept {
+        if (this != &other) {
+            chunks   = std::move(other.chunks);
+            used     = std::exchange(other.used, 0);
+            capacity = std::exchange(other.capacity, 0);
+            other.chunks.clear();
+        }
+        return *this;
+    }
+
+    const char* store(string_view str) {
+        size_t need = str.size() + 1;
+        if (need > capacity - used) {
+            capacity = std::max(need, chunk_size);
+            used     = 0;
+            chunks.emplace_back(new char[capacity]);
+        }
+        char* p = chunks.back().get() + used;
+        std::memcpy(p, str.data(), str.size());
+        p[str.size()] = '\0';
+        used += need;
+        return p;
+    }
+
+    void clear() {
+        chunks.clear();
+        used = capacity = 0;
+    }
+
+private:
+    static constexpr size_t chunk_size = 4096;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t                               used     = 0;
+    size_t                               capacity = 0;
+};
+
+// remove the file when the command that reads it has finished
+class ResponseFile {
+public:
+    Path path;
+
+public:
+    ResponseFile() = default;
+    ResponseFile(const ResponseFile&) = delete;
+    ResponseFile(ResponseFile&& other) noexcept : path(std::exchange(other.path, {})) {};
+
+    ~ResponseFile() {
+        if (!path.empty()) {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    }
+};
+
 class Cmd {
 public:
+    Cmd() { args.push_back(nullptr); }
+
     template <typename... T>
-    Cmd(T&&... t) { (AppendDispatch(std::forward<T>(t)), ...); }
+        requires(sizeof...(T) > 0 && !(sizeof...(T) == 1 && (std::is_same_v<std::remove_cvref_t<T>, Cmd> && ...)))
+    Cmd(T&&... t) : Cmd() { (AppendDispatch(std::forward<T>(t)), ...); }
+
+    Cmd(const Cmd& other) : Cmd() {
+        response_file = other.response_file;
+        args.reserve(other.args.size());
+        for (size_t i = 0; i < other.size(); i++) { Push(arena.store(other.args[i])); }
+    }
+
+    Cmd(Cmd&&) noexcept = default;
+
+    Cmd& operator=(const Cmd& other) {
+        if (this != &other) *this = Cmd(other);
+        return *this;
+    }
+
+    Cmd& operator=(Cmd&&) noexcept = default;
 
 public:
     template <typename... T>
     void Append(T&&... t) { (AppendDispatch(std::forward<T>(t)), ...); }
 
     void AppendRange(int argc, char** argv) {
-        params.reserve(params.size() + argc);
+        args.reserve(args.size() + argc);
         for (int i = 0; i < argc; i++) {
-            params.emplace_back(argv[i]);
+            Push(arena.store(argv[i]));
         }
     }
 
-    void Clear() { params.clear(); };
+    void Clear() {
+        args.assign(1, nullptr);
+        blocks.clear();
+        arena.clear();
+        response_file = false;
+    };
+
+    // only set for programs that read `@file`, like compilers and linkers
+    Cmd& AllowResponseFile(bool allow = true) & {
+        response_file = allow;
+        return *this;
+    }
+
+    Cmd&& AllowResponseFile(bool allow = true) && {
+        response_file = allow;
+        return std::move(*this);
+    }
 
     string GetCommandStr() const {
         string Command;
-        for (size_t i = 0; i < params.size(); i++) {
-            string_view arg = params[i];
+        for (size_t i = 0; i < size(); i++) {
             if (i > 0) Command.append(" ");
-            if (!arg.empty() && string_view::npos == arg.find_first_of(" \t\n\v\"")) {
-                Command.append(arg);
-            } else {
-                Command.append("\"");
-                size_t backslashes = 0;
-                for (size_t j = 0; j < arg.length(); ++j) {
-                    switch (arg[j]) {
-                        case '\\':
-                            backslashes += 1;
-                            break;
-                        case '\"':
-                            Command.append(2 * backslashes + 1, '\\');
-                            backslashes = 0;
-                            Command.push_back(arg[j]);
-                            break;
-                        default:
-                            Command.append(backslashes, '\\');
-                            backslashes = 0;
-                            Command.push_back(arg[j]);
-                            break;
-                    }
-                }
-                Command.append(2 * backslashes, '\\');
-                Command.append("\"");
-            }
+            QuoteArg(Command, args[i]);
         }
         return Command;
     }
 
     bool empty() const {
-        return params.empty();
+        return size() == 0;
+    }
+
+    size_t size() const {
+        return args.empty() ? 0 : args.size() - 1;
+    }
+
+    string_view operator[](size_t i) const {
+        return args[i];
+    }
+
+    // null terminated, ready for execvp
+    char* const* argv() const {
+        return const_cast<char* const*>(args.data());
+    }
+
+    bool NeedResponseFile() const {
+#ifdef _WIN32
+        return GetCommandStr().size() >= OS::arg_max();
+#else
+        size_t bytes = 0;
+        for (size_t i = 0; i < size(); i++) {
+            size_t len = std::strlen(args[i]);
+            if (len >= OS::arg_strlen_max) return true;
+            bytes += len + 1 + sizeof(char*);
+        }
+        return bytes >= OS::arg_max();
+#endif // _WIN32
+    }
+
+    // move every argument but the program into a response file, returns `program @file`
+    Result<Cmd> ToResponseFile(ResponseFile& rsp) const {
+        static std::atomic<size_t> counter = 0;
+
+        if (empty()) return Reason("could not write response file for empty command!");
+        if (!response_file) return Reason(string("command line of ") + args[0] + " is too long and it does not read response files!");
+        string content;
+        for (size_t i = 1; i < size(); i++) {
+#ifdef _WIN32
+            QuoteArg(content, args[i]);
+#else
+            for (const char* c = args[i]; *c; ++c) {
+                if (std::strchr(" \t\n\v\f\r\"'\\", *c)) content.push_back('\\');
+                content.push_back(*c);
+            }
+#endif // _WIN32
+            content.push_back('\n');
+        }
+
+        std::error_code ec;
+        Path            dir = std::filesystem::temp_directory_path(ec);
+        if (ec) dir = ".";
+#ifdef _WIN32
+        string id = std::to_string(GetCurrentProcessId());
+#else
+        string id = std::to_string(getpid());
+#endif // _WIN32
+        rsp.path = dir / ("csc-" + id + "-" + std::to_string(counter++) + ".rsp");
+
+        std::ofstream file(rsp.path, std::ios::binary);
+        if (!file || !file.write(content.data(), content.size())) {
+            return Reason("failed to write response file! [\"" + rsp.path.string() + "\"]");
+        }
+        return Cmd(args[0], "@" + rsp.path.generic_string());
     }
 
 private:
-    std::vector<string> params;
+    // argument pointers into `arena` or into one of `blocks`, always ends with nullptr
+    std::vector<const char*> args;
+    std::vector<OptionBlock> blocks;
+    Arena                    arena;
+    bool                     response_file = false;
 
 private:
-    void AppendDispatch(const char* s) { params.emplace_back(s); }
+    static void QuoteArg(string& Command, string_view arg) {
+        if (!arg.empty() && string_view::npos == arg.find_first_of(" \t\n\v\"")) {
+            Command.append(arg);
+            return;
+        }
+        Command.append("\"");
+        size_t backslashes = 0;
+        for (size_t j = 0; j < arg.length(); ++j) {
+            switch (arg[j]) {
+                case '\\':
+                    backslashes += 1;
+                    break;
+                case '\"':
+                    Command.append(2 * backslashes + 1, '\\');
+                    backslashes = 0;
+                    Command.push_back(arg[j]);
+                    break;
+                default:
+                    Command.append(backslashes, '\\');
+                    backslashes = 0;
+                    Command.push_back(arg[j]);
+                    break;
+            }
+        }
+        Command.append(2 * backslashes, '\\');
+        Command.append("\"");
+    }
+
+    void Push(const char* arg) {
+        if (args.empty()) args.push_back(nullptr);
+        args.back() = arg;
+        args.push_back(nullptr);
+    }
 
-    void AppendDispatch(const string& s) { params.emplace_back(s); }
+    void AppendDispatch(const char* s) { Push(arena.store(s)); }
 
-    void AppendDispatch(const string&& s) { params.emplace_back(std::move(s)); }
+    void AppendDispatch(const string& s) { Push(arena.store(s)); }
 
-    void AppendDispatch(string_view s) { params.emplace_back(s); }
+    void AppendDispatch(string_view s) { Push(arena.store(s)); }
 
     void AppendDispatch(const Path& p) {
-        params.emplace_back(p.generic_string());
+        Push(arena.store(p.generic_string()));
     }
 
     void AppendDispatch(const std::vector<Path>& paths) {
-        params.reserve(params.size() + paths.size());
-        for (auto& path : paths) { params.emplace_back(path.generic_string()); }
+        args.reserve(args.size() + paths.size());
+        for (auto& path : paths) { Push(arena.store(path.generic_string())); }
     }
 
     void AppendDispatch(const std::vector<string>& paths) {
-        params.reserve(params.size() + paths.size());
-        for (auto& path : paths) { params.emplace_back(path); }
+        args.reserve(args.size() + paths.size());
+        for (auto& path : paths) { Push(arena.store(path)); }
+    }
+
+    // shared options are referenced in place, not copied
+    void AppendDispatch(const OptionBlock& block) {
+        if (!block) return;
+        args.reserve(args.size() + block->size());
+        for (auto& option : *block) { Push(option.c_str()); }
+        blocks.push_back(block);
     }
 };
 
@@ -386,11 +950,22 @@ inline bool run_cmd(const Cmd& cmd, Cmdopt opt = Cmdopt()) {
         return false;
     }
     // log(CODE, cmd.GetCommandStr());
+    ResponseFile rsp;
+    Cmd          spilled;
+    if (cmd.NeedResponseFile()) {
+        auto result = cmd.ToResponseFile(rsp);
+        if (!result) {
+            log(ERRO, "%s", result.error().c_str());
+            return false;
+        }
+        spilled = std::move(result.value());
+    }
+    const Cmd& exec = spilled.empty() ? cmd : spilled;
 #ifdef _WIN32
     STARTUPINFOA        si = {sizeof(si)};
     PROCESS_INFORMATION pi;
 
-    BOOL result = CreateProcessA(NULL, cmd.GetCommandStr().data(), NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+    BOOL result = CreateProcessA(NULL, exec.GetCommandStr().data(), NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
     if (!result) {
         log(ERRO, "CreateProcess failed!");
         return false;
@@ -408,126 +983,1240 @@ inline bool run_cmd(const Cmd& cmd, Cmdopt opt = Cmdopt()) {
         return false;
     }
     if (cpid == 0) {
-        // if ()
+        execvp(exec.argv()[0], exec.argv());
+        log(ERRO, "Could not exec %s: %s!", exec.argv()[0], std::strerror(errno));
+        _exit(127);
+    }
+    int status = 0;
+    while (waitpid(cpid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            log(ERRO, "Could not wait child process: %s!", std::strerror(errno));
+            return false;
+        }
     }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
 #endif // _Win32
-    return true;
 }
 
-namespace ToolChain {
+struct CmdResult {
+    int    status    = -1;    // exit code, -1 when the process could not be started
+    string output;            // stdout and stderr in the order they were written
+    double seconds   = 0;     // wall time since the process started, queueing excluded
+    bool   cancelled = false; // terminated, or never started, by EventLoop::cancel
 
-enum class CompilerType {
-    clang,
-    gcc,
+    bool ok() const {
+        return status == 0;
+    }
 };
 
-class Compiler {
-public:
-    Path exe;
+template <typename T = void>
+class Task;
 
-public:
-    Compiler() = delete;
-    Compiler(Path path) : exe(path) {};
+namespace async_impl {
+template <typename T>
+using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
 
-public:
-    virtual bool link_target(const Path& output, const std::vector<Path>& depfiles) {
-        Cmd cmd(exe, depfiles, "-o", output);
-        return run_cmd(cmd);
-    }
+struct PromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr      exception;
 
-    virtual std::vector<std::string> compile_flag(const Path& unit)                   = 0;
-    virtual std::vector<std::string> out_flag(const Path& unit)                       = 0;
-    virtual std::vector<std::string> dep_flag(const Path& unit, const Path& obj = "") = 0;
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
 
-    virtual Cmd get_compile_unit_cmd(const Path& input, const Path& output, const std::vector<string>& options) {
-        return {exe, "-c", input, "-o", output, options};
-    }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+            return handle.promise().continuation;
+        }
 
-    virtual Cmd get_link_target_cmd(const Path& output, const std::vector<Path>& depfiles) {
-        return {exe, depfiles, "-o", output};
-    }
+        void await_resume() noexcept {}
+    };
 
-    virtual Cmd get_compile_and_gendep_unit_cmd(const Path& input, const Path& obj, const Path& dep, const std::vector<string>& options) {
-        return {exe, "-c", input, "-o", obj, "-MMD", "-MF", dep, "-MT", obj, options};
-    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
 
-    virtual Cmd get_compile_module_cmd(const Path& input, const Path& output, const std::vector<string>& options) {
-        return {exe, "--precompile", "-o", output};
-    }
-};
+    FinalAwaiter final_suspend() noexcept { return {}; }
 
-class GNU_Compiler : public Compiler {
-public:
-    // GNU_Compiler(const Path& path) : Compiler(path) {};
-    using Compiler::Compiler;
+    void unhandled_exception() { exception = std::current_exception(); }
+};
 
-    virtual std::vector<std::string> compile_flag(const Path& unit) {
-        return {"-c", unit.generic_string()};
-    }
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
 
-    virtual std::vector<std::string> out_flag(const Path& obj) {
-        return {"-o", obj.generic_string()};
-    }
+    Task<T> get_return_object();
 
-    virtual std::vector<std::string> dep_flag(const Path& dep, const Path& obj = "") {
-        std::vector<std::string> flags = {"-MMD", "-MF", dep.generic_string()};
-        if (!obj.empty()) {
-            flags.push_back("-MT");
-            flags.push_back(obj.generic_string());
-        }
+    template <typename U>
+    void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
 
-        return flags;
+    T take() {
+        if (exception) std::rethrow_exception(exception);
+        return std::move(*value);
     }
 };
 
-class Clang : public GNU_Compiler {
-public:
-    using GNU_Compiler::GNU_Compiler;
-    Clang() : GNU_Compiler("clang++") {};
-
-    std::vector<string> compile_module_option(const Path& uints, const Path& targetdir = ".") {
-        Path targetpath = targetdir / uints.filename().string();
-        targetpath.replace_extension(".pcm");
-        return {uints.generic_string(), "--precompile", "-o", targetpath.string()};
-    }
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
 
-private:
-};
+    void return_void() {}
 
-inline std::shared_ptr<Compiler> find_compiler(const Dir& dir) {
-    Path exe = dir / "bin" / "clang++";
-    if (std::filesystem::exists(exe)) {
-        return std::make_shared<Clang>(exe);
+    void take() {
+        if (exception) std::rethrow_exception(exception);
     }
-    throw std::runtime_error("undetected compiler.");
-}
+};
+} // namespace async_impl
 
-class ToolChain {
+// lazy coroutine, starts when it is awaited or passed to sync_wait
+template <typename T>
+class Task {
 public:
-    Dir base;
+    using promise_type = async_impl::Promise<T>;
+    using handle_type  = std::coroutine_handle<promise_type>;
 
 public:
-    ToolChain() = delete;
+    Task() = default;
 
-    ToolChain(const Dir& path) : base(path) {};
+    explicit Task(handle_type h) : handle(h) {};
 
-    virtual Dir  get_stdlib_dir() const;
-    virtual bool scan_module_dep(const Path& input, const std::vector<string>& compile_command);
+    Task(const Task&) = delete;
 
-private:
-};
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) {};
 
-class LLVM_MinGW : public ToolChain {
-public:
-    using ToolChain::ToolChain;
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
 
-    virtual Dir get_stdlib_dir() const override {
-        return base / "share" / "libc++" / "v1";
+    ~Task() {
+        if (handle) handle.destroy();
     }
 
-    virtual bool scan_module_dep(const Path& input, const std::vector<string>& compile_command) override {
-        Cmd cmd(base / "bin" / "clang-scan-deps", "--format=p1689", "--", compile_command);
-        return run_cmd(cmd);
+    bool done() const {
+        return !handle || handle.done();
+    }
+
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            handle_type handle;
+
+            bool await_ready() noexcept { return !handle || handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                handle.promise().continuation = caller;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().take(); }
+        };
+        return Awaiter{handle};
+    }
+
+private:
+    handle_type handle;
+
+    template <typename U>
+    friend U sync_wait(Task<U> task);
+};
+
+namespace async_impl {
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+struct Job {
+    Cmd                     cmd;
+    CmdResult               result;
+    std::coroutine_handle<> waiter;
+    ResponseFile            rsp;
+    size_t                  weight     = 1;
+    bool                    terminated = false; // cancel() asked it to stop
+
+    std::chrono::steady_clock::time_point started;
+#ifdef _WIN32
+    HANDLE process = nullptr;
+    HANDLE tree    = nullptr; // job object holding the process and its children
+#else
+    pid_t pid   = -1;
+    int   fd    = -1;
+    bool  group = false; // leads its own process group
+#endif // _WIN32
+};
+
+#ifndef _WIN32
+// set by the handler, the pipe wakes up a poll that is already waiting
+inline volatile sig_atomic_t received_signal = 0;
+inline int                   signal_pipe[2]  = {-1, -1};
+
+inline void on_signal(int signo) {
+    int saved       = errno;
+    received_signal = signo;
+    if (signal_pipe[1] >= 0) (void)!write(signal_pipe[1], "", 1);
+    errno = saved;
+}
+
+// children in process groups of their own miss the terminal's Ctrl-C, so while the loop
+// runs SIGINT, SIGTERM and SIGHUP cancel them instead; the signal is raised again at the end
+class SignalForward {
+public:
+    explicit SignalForward(bool enable) : active(enable) {
+        if (!active) return;
+        if (signal_pipe[0] < 0 && pipe(signal_pipe) == 0) {
+            for (int fd : signal_pipe) {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+            }
+        }
+        received_signal = 0;
+
+        struct sigaction action {};
+        action.sa_handler = on_signal;
+        sigemptyset(&action.sa_mask);
+        for (size_t i = 0; i < std::size(signals); ++i) { sigaction(signals[i], &action, &saved[i]); }
+    }
+
+    SignalForward(const SignalForward&) = delete;
+
+    ~SignalForward() {
+        if (!active) return;
+        for (size_t i = 0; i < std::size(signals); ++i) { sigaction(signals[i], &saved[i], nullptr); }
+        if (received_signal) raise(received_signal);
+    }
+
+private:
+    static constexpr int signals[] = {SIGINT, SIGTERM, SIGHUP};
+
+    bool             active;
+    struct sigaction saved[std::size(signals)];
+};
+#endif // _WIN32
+} // namespace async_impl
+
+// single threaded scheduler for every task and child process of the script
+class EventLoop {
+public:
+    // upper bound of child processes running at once
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    // cancel everything else once a command fails, children get a process group of their own then
+    bool fail_fast = false;
+
+public:
+    static EventLoop& current() {
+        static EventLoop loop;
+        return loop;
+    }
+
+    void post(std::coroutine_handle<> handle) { ready.push_back(handle); }
+
+    void submit(async_impl::Job* job) {
+        if (cancelled) return drop(job);
+        pending.push_back(job);
+    }
+
+    // SIGTERM to the process group of every running command, queued ones never start;
+    // holds for whatever is submitted until run() returns
+    void cancel() {
+        cancelled = true;
+        while (!pending.empty()) {
+            async_impl::Job* job = pending.front();
+            pending.pop_front();
+            drop(job);
+        }
+        // whether that is what ended a job is only known once it is reaped
+        for (auto* job : running) {
+            job->terminated = true;
+#ifdef _WIN32
+            if (job->tree) {
+                TerminateJobObject(job->tree, terminated_code);
+            } else {
+                TerminateProcess(job->process, terminated_code);
+            }
+#else
+            kill(job->group ? -job->pid : job->pid, SIGTERM);
+#endif // _WIN32
+        }
+    }
+
+    // resume tasks and reap processes until there is nothing left to do
+    void run() {
+        if (active) throw std::logic_error("csc event loop is already running, co_await the task instead");
+        active = true;
+        struct Guard {
+            bool& flag;
+            bool& cancelled;
+
+            ~Guard() { flag = cancelled = false; }
+        } guard{active, cancelled};
+#ifndef _WIN32
+        async_impl::SignalForward forward(fail_fast);
+#endif // _WIN32
+
+        while (true) {
+#ifndef _WIN32
+            if (async_impl::received_signal && !cancelled) cancel();
+#endif // _WIN32
+            while (!ready.empty()) {
+                auto handle = ready.front();
+                ready.pop_front();
+                handle.resume();
+            }
+            // a job heavier than the whole limit still runs, alone
+            while (!pending.empty() && (running_weight == 0 || running_weight + pending.front()->weight <= jobs)) {
+                async_impl::Job* job = pending.front();
+                pending.pop_front();
+                start(job);
+            }
+            if (running.empty()) {
+                if (ready.empty() && pending.empty()) break;
+                continue;
+            }
+            wait();
+        }
+    }
+
+private:
+    std::deque<std::coroutine_handle<>> ready;
+    std::deque<async_impl::Job*>        pending;
+    std::vector<async_impl::Job*>       running;
+    size_t                              running_weight = 0;
+    bool                                active         = false;
+    bool                                cancelled      = false;
+#ifdef _WIN32
+    static constexpr UINT terminated_code = 128 + 15; // what a shell reports for SIGTERM
+
+    // filled by the reader threads of the running jobs
+    std::mutex                    reaped_mutex;
+    std::condition_variable       reaped_cv;
+    std::vector<async_impl::Job*> reaped;
+#endif // _WIN32
+
+private:
+    void finish(async_impl::Job* job) {
+        job->result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->started).count();
+        if (fail_fast && !job->result.ok() && !job->result.cancelled && !cancelled) {
+            cancel();
+        }
+        post(job->waiter);
+    }
+
+    void drop(async_impl::Job* job) {
+        job->result.cancelled = true;
+        post(job->waiter);
+    }
+
+    void start(async_impl::Job* job) {
+        job->started    = std::chrono::steady_clock::now();
+        const Cmd* exec = &job->cmd;
+        Cmd        spilled;
+        if (job->cmd.NeedResponseFile()) {
+            auto result = job->cmd.ToResponseFile(job->rsp);
+            if (!result) {
+                job->result.output = result.error();
+                return finish(job);
+            }
+            spilled = std::move(result.value());
+            exec    = &spilled;
+        }
+#ifdef _WIN32
+        SECURITY_ATTRIBUTES inherit{sizeof(inherit), nullptr, TRUE};
+        HANDLE              read_end, write_end;
+        if (!CreatePipe(&read_end, &write_end, &inherit, 0)) {
+            job->result.output = "Could not create pipe!";
+            return finish(job);
+        }
+        SetHandleInformation(read_end, HANDLE_FLAG_INHERIT, 0);
+        HANDLE null = CreateFileA("NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &inherit, OPEN_EXISTING, 0, nullptr);
+
+        STARTUPINFOA si = {sizeof(si)};
+        si.dwFlags      = STARTF_USESTDHANDLES;
+        si.hStdInput    = null;
+        si.hStdOutput   = write_end;
+        si.hStdError    = write_end;
+        PROCESS_INFORMATION pi;
+
+        // only this thread creates processes, so no other job's write end is open to be inherited
+        string command = exec->GetCommandStr();
+        BOOL   created = CreateProcessA(nullptr, command.data(), nullptr, nullptr, TRUE, CREATE_SUSPENDED, nullptr, nullptr, &si, &pi);
+        CloseHandle(write_end);
+        if (null != INVALID_HANDLE_VALUE) CloseHandle(null);
+        if (!created) {
+            CloseHandle(read_end);
+            job->result.output = "Could not exec " + string(exec->argv()[0]) + "!\n";
+            return finish(job);
+        }
+        job->tree = CreateJobObjectA(nullptr, nullptr);
+        if (job->tree && !AssignProcessToJobObject(job->tree, pi.hProcess)) {
+            CloseHandle(job->tree);
+            job->tree = nullptr;
+        }
+        ResumeThread(pi.hThread);
+        CloseHandle(pi.hThread);
+        job->process = pi.hProcess;
+        running.push_back(job);
+        running_weight += job->weight;
+
+        // anonymous pipes cannot be polled, a thread per job drains its output and reports the exit
+        std::thread([this, job, read_end] {
+            char   buffer[4096];
+            DWORD  n = 0;
+            string output;
+            while (::ReadFile(read_end, buffer, sizeof(buffer), &n, nullptr) && n > 0) { output.append(buffer, n); }
+            CloseHandle(read_end);
+            WaitForSingleObject(job->process, INFINITE);
+            DWORD code = 1;
+            GetExitCodeProcess(job->process, &code);
+
+            // the loop may be destroyed as soon as the lock is released
+            std::lock_guard lock(reaped_mutex);
+            job->result.output += output;
+            job->result.status = int(code);
+            reaped.push_back(job);
+            reaped_cv.notify_one();
+        }).detach();
+#else
+        int fds[2];
+        if (pipe(fds) != 0) {
+            job->result.output = std::strerror(errno);
+            return finish(job);
+        }
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+        job->group = fail_fast;
+        pid_t cpid = fork();
+        if (cpid < 0) {
+            job->result.output = std::strerror(errno);
+            close(fds[0]);
+            close(fds[1]);
+            return finish(job);
+        }
+        if (cpid == 0) {
+            if (job->group) setpgid(0, 0);
+            int null = open("/dev/null", O_RDONLY);
+            if (null >= 0) dup2(null, STDIN_FILENO);
+            dup2(fds[1], STDOUT_FILENO);
+            dup2(fds[1], STDERR_FILENO);
+            execvp(exec->argv()[0], exec->argv());
+            std::fprintf(stderr, "Could not exec %s: %s!\n", exec->argv()[0], std::strerror(errno));
+            _exit(127);
+        }
+        close(fds[1]);
+        if (job->group) setpgid(cpid, cpid); // either side may run first
+        job->pid = cpid;
+        job->fd  = fds[0];
+        running.push_back(job);
+        running_weight += job->weight;
+#endif // _WIN32
+    }
+
+    void wait() {
+#ifdef _WIN32
+        std::vector<async_impl::Job*> done;
+        {
+            std::unique_lock lock(reaped_mutex);
+            reaped_cv.wait(lock, [this] { return !reaped.empty(); });
+            done.swap(reaped);
+        }
+        for (auto* job : done) {
+            job->result.cancelled = job->terminated && job->result.status == int(terminated_code);
+            CloseHandle(job->process);
+            if (job->tree) CloseHandle(job->tree);
+            running.erase(std::find(running.begin(), running.end(), job));
+            running_weight -= job->weight;
+            finish(job);
+        }
+#else
+        std::vector<pollfd> fds;
+        fds.reserve(running.size() + 1);
+        for (auto* job : running) { fds.push_back({job->fd, POLLIN, 0}); }
+        if (fail_fast && async_impl::signal_pipe[0] >= 0) fds.push_back({async_impl::signal_pipe[0], POLLIN, 0});
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) return;
+            throw std::system_error(errno, std::generic_category(), "poll");
+        }
+
+        char buffer[4096];
+        if (fds.size() > running.size()) {
+            if (fds.back().revents != 0) {
+                while (read(async_impl::signal_pipe[0], buffer, sizeof(buffer)) > 0) {}
+                if (!cancelled) cancel();
+            }
+            fds.pop_back();
+        }
+        for (size_t i = fds.size(); i-- > 0;) {
+            if (fds[i].revents == 0) continue;
+            async_impl::Job* job = running[i];
+
+            ssize_t n = read(job->fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                job->result.output.append(buffer, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+
+            close(job->fd);
+            int status = 0;
+            while (waitpid(job->pid, &status, 0) < 0 && errno == EINTR) {}
+            job->result.status    = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            job->result.cancelled = job->terminated && WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM;
+
+            running.erase(running.begin() + i);
+            running_weight -= job->weight;
+            finish(job);
+        }
+#endif // _WIN32
+    }
+};
+
+// co_await spawn(cmd) runs the command once a job slot is free
+class spawn {
+public:
+    // `weight` job slots are taken by commands that are multithreaded themselves
+    explicit spawn(Cmd cmd, size_t weight = 1) {
+        job.cmd    = std::move(cmd);
+        job.weight = std::max<size_t>(weight, 1);
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        job.waiter = handle;
+        if (job.cmd.empty()) {
+            job.result.output = "Could not run empty command!";
+            EventLoop::current().post(handle);
+            return;
+        }
+        EventLoop::current().submit(&job);
+    }
+
+    CmdResult await_resume() { return std::move(job.result); }
+
+private:
+    async_impl::Job job;
+};
+
+// run the task and everything it started to completion
+template <typename T>
+T sync_wait(Task<T> task) {
+    EventLoop& loop = EventLoop::current();
+    loop.post(task.handle);
+    loop.run();
+    if (!task.done()) throw std::logic_error("task never finished, it waits on nothing");
+    return task.handle.promise().take();
+}
+
+namespace async_impl {
+// eager, self destroying coroutine that feeds a Join
+struct Fire {
+    struct promise_type {
+        Fire get_return_object() noexcept {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+struct Join {
+    size_t                  remaining;
+    std::coroutine_handle<> waiter;
+    std::exception_ptr      exception;
+
+    void start(Fire fire) { EventLoop::current().post(fire.handle); }
+
+    void fail(std::exception_ptr e) {
+        if (!exception) exception = e;
+    }
+
+    void arrive() {
+        if (remaining > 0 && --remaining == 0 && waiter) EventLoop::current().post(waiter);
+    }
+
+    void rethrow() const {
+        if (exception) std::rethrow_exception(exception);
+    }
+
+    bool await_ready() const noexcept { return remaining == 0; }
+
+    void await_suspend(std::coroutine_handle<> handle) noexcept { waiter = handle; }
+
+    void await_resume() const noexcept {}
+};
+
+template <typename T>
+Fire run_into(Task<T>& task, std::optional<Value<T>>& slot, Join& join) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            slot.emplace();
+        } else {
+            slot.emplace(co_await task);
+        }
+    } catch (...) {
+        join.fail(std::current_exception());
+    }
+    join.arrive();
+}
+
+template <typename T>
+struct AnyState {
+    std::vector<Task<T>>                        tasks;
+    std::optional<std::pair<size_t, Value<T>>> winner;
+    Join                                        join{1};
+};
+
+// holds the state itself, the losers keep running after when_any returned
+template <typename T>
+Fire run_any(std::shared_ptr<AnyState<T>> state, size_t index) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await state->tasks[index];
+            if (!state->winner && state->join.remaining) state->winner.emplace(index, std::monostate{});
+        } else {
+            auto value = co_await state->tasks[index];
+            if (!state->winner && state->join.remaining) state->winner.emplace(index, std::move(value));
+        }
+    } catch (...) {
+        if (state->join.remaining) state->join.fail(std::current_exception());
+    }
+    state->join.arrive();
+}
+} // namespace async_impl
+
+template <typename T>
+Task<std::vector<async_impl::Value<T>>> when_all(std::vector<Task<T>> tasks) {
+    async_impl::Join                                  join{tasks.size()};
+    std::vector<std::optional<async_impl::Value<T>>> slots(tasks.size());
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        join.start(async_impl::run_into(tasks[i], slots[i], join));
+    }
+    co_await join;
+    join.rethrow();
+
+    std::vector<async_impl::Value<T>> results;
+    results.reserve(slots.size());
+    for (auto& slot : slots) { results.push_back(std::move(*slot)); }
+    co_return results;
+}
+
+template <typename... T>
+Task<std::tuple<async_impl::Value<T>...>> when_all(Task<T>... tasks) {
+    async_impl::Join                                 join{sizeof...(T)};
+    std::tuple<std::optional<async_impl::Value<T>>...> slots;
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        (join.start(async_impl::run_into(tasks, std::get<I>(slots), join)), ...);
+    }(std::index_sequence_for<T...>{});
+    co_await join;
+    join.rethrow();
+
+    co_return std::apply([](auto&... slot) { return std::tuple<async_impl::Value<T>...>(std::move(*slot)...); }, slots);
+}
+
+// index and result of the first task to finish
+template <typename T>
+Task<std::pair<size_t, async_impl::Value<T>>> when_any(std::vector<Task<T>> tasks) {
+    if (tasks.empty()) throw std::invalid_argument("when_any needs at least one task");
+
+    auto state   = std::make_shared<async_impl::AnyState<T>>();
+    state->tasks = std::move(tasks);
+    for (size_t i = 0; i < state->tasks.size(); ++i) {
+        state->join.start(async_impl::run_any(state, i));
+    }
+    co_await state->join;
+    state->join.rethrow();
+    co_return std::move(*state->winner);
+}
+
+namespace ToolChain {
+
+enum class CompilerType {
+    clang,
+    gcc,
+};
+
+struct CompilerInfo {
+    Path                exe; // resolved, not a bare name
+    CompilerType        type = CompilerType::gcc;
+    string              version;
+    string              triple;
+    std::vector<string> include_dirs;
+    OS::FileStat        stat;
+
+    uint64_t fingerprint() const {
+        uint64_t hash = hash_bytes(exe.generic_string());
+        hash          = hash_combine(hash, stat.mtime);
+        hash          = hash_combine(hash, stat.size);
+        hash          = hash_bytes(version, hash_combine(hash, uint64_t(type)));
+        hash          = hash_bytes(triple, hash);
+        for (auto& dir : include_dirs) {
+            hash = hash_combine(hash_bytes(dir, hash), dir.size());
+        }
+        return hash;
+    }
+};
+
+// run a short command to completion on a private loop, safe to call from inside a task
+inline CmdResult capture_cmd(Cmd cmd) {
+    EventLoop       loop;
+    async_impl::Job job;
+    job.cmd    = std::move(cmd);
+    job.waiter = std::noop_coroutine();
+    loop.submit(&job);
+    loop.run();
+    return std::move(job.result);
+}
+
+// probe results persisted across runs, keyed on the compiler binary's path, mtime and size
+class CompilerCache {
+public:
+    static CompilerCache& get() {
+        static CompilerCache cache;
+        return cache;
+    }
+
+    static Path default_path() {
+#ifdef _WIN32
+        const char* base = std::getenv("LOCALAPPDATA");
+        return base ? Path(base) / "csc" / "compilers" : Path("build") / ".csc_compilers";
+#else
+        if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) return Path(xdg) / "csc" / "compilers";
+        const char* home = std::getenv("HOME");
+        return home ? Path(home) / ".cache" / "csc" / "compilers" : Path("build") / ".csc_compilers";
+#endif // _WIN32
+    }
+
+    Result<CompilerInfo> query(const Path& program) {
+        Path exe = program;
+        if (!program.has_parent_path()) {
+            auto found = OS::find_program(program.string());
+            if (!found) return Reason("could not find " + program.string() + " in PATH");
+            exe = *found;
+        }
+        OS::FileStat stat = OS::stat_file(exe);
+        if (!stat.exists) return Reason("compiler does not exist! [\"" + exe.string() + "\"]");
+
+        load();
+        auto it = entries.find(exe.generic_string());
+        if (it != entries.end() && it->second.stat == stat) return it->second;
+
+        auto info = probe(exe);
+        if (!info) return info;
+        info->stat                     = stat;
+        entries[exe.generic_string()] = *info;
+        save();
+        return info;
+    }
+
+private:
+    Path                                          path = default_path();
+    std::unordered_map<string, CompilerInfo> entries;
+    bool                                          loaded = false;
+
+private:
+    static Result<CompilerInfo> probe(const Path& exe) {
+        CompilerInfo info;
+        info.exe = exe;
+
+        CmdResult about = capture_cmd(Cmd(exe, "--version"));
+        if (!about.ok()) return Reason("could not run " + exe.string() + " --version");
+        info.type = about.output.find("clang version") != string::npos ? CompilerType::clang : CompilerType::gcc;
+
+        auto first_line = [](const string& output) {
+            string line = output.substr(0, output.find('\n'));
+            while (!line.empty() && std::isspace((unsigned char)line.back())) line.pop_back();
+            return line;
+        };
+        info.version = first_line(capture_cmd(Cmd(exe, info.type == CompilerType::clang ? "-dumpversion" : "-dumpfullversion")).output);
+        info.triple  = first_line(capture_cmd(Cmd(exe, "-dumpmachine")).output);
+
+        // "#include <...> search starts here:" up to "End of search list."
+        CmdResult   search = capture_cmd(Cmd(exe, "-E", "-x", "c++", "-", "-v"));
+        string_view data   = search.output;
+        bool        inside = false;
+        while (!data.empty()) {
+            size_t      end  = data.find('\n');
+            string_view line = data.substr(0, end);
+            data.remove_prefix(end == string_view::npos ? data.size() : end + 1);
+
+            if (line.starts_with("#include <...>")) {
+                inside = true;
+            } else if (line.starts_with("End of search list.")) {
+                break;
+            } else if (inside) {
+                while (!line.empty() && std::isspace((unsigned char)line.front())) line.remove_prefix(1);
+                while (!line.empty() && std::isspace((unsigned char)line.back())) line.remove_suffix(1);
+                if (line.ends_with(" (framework directory)")) line.remove_suffix(22);
+                info.include_dirs.emplace_back(line);
+            }
+        }
+        if (info.version.empty() || info.triple.empty()) return Reason("could not query " + exe.string());
+        return info;
+    }
+
+    void load() {
+        if (loaded) return;
+        loaded = true;
+
+        // "compiler <mtime> <size> <path>", then "type", "version", "triple" and "include" lines
+        CompilerInfo* current = nullptr;
+        bool          bad     = false;
+        OS::read_lines(path, [&](string_view line) {
+            size_t      space = line.find(' ');
+            string_view key   = line.substr(0, space);
+            string_view value = space == string_view::npos ? "" : line.substr(space + 1);
+            if (bad) {
+                return;
+            } else if (key == "compiler") {
+                OS::FileStat stat;
+                size_t       first  = value.find(' ');
+                size_t       second = value.find(' ', first + 1);
+                if (second == string_view::npos) {
+                    bad = true;
+                    return;
+                }
+                std::from_chars(value.data(), value.data() + first, stat.mtime);
+                std::from_chars(value.data() + first + 1, value.data() + second, stat.size);
+                stat.exists = true;
+
+                string exe(value.substr(second + 1));
+                current       = &entries[exe];
+                current->exe  = exe;
+                current->stat = stat;
+            } else if (!current) {
+                return;
+            } else if (key == "type") {
+                current->type = value == "clang" ? CompilerType::clang : CompilerType::gcc;
+            } else if (key == "version") {
+                current->version = value;
+            } else if (key == "triple") {
+                current->triple = value;
+            } else if (key == "include") {
+                current->include_dirs.emplace_back(value);
+            }
+        });
+        if (bad) entries.clear();
+    }
+
+    void save() const {
+        string content;
+        for (auto& [exe, info] : entries) {
+            content += "compiler " + std::to_string(info.stat.mtime) + " " + std::to_string(info.stat.size) + " " + exe + "\n";
+            content += info.type == CompilerType::clang ? "type clang\n" : "type gcc\n";
+            content += "version " + info.version + "\n";
+            content += "triple " + info.triple + "\n";
+            for (auto& dir : info.include_dirs) { content += "include " + dir + "\n"; }
+        }
+        OS::write_file(path, content);
+    }
+};
+
+inline Result<CompilerInfo> query_compiler(const Path& exe) {
+    return CompilerCache::get().query(exe);
+}
+
+
+enum class Linker {
+    system,
+    bfd,
+    gold,
+    lld,
+    mold,
+};
+
+enum class DebugInfo {
+    none,
+    full,
+    split, // -gsplit-dwarf, the linker only writes a gdb index
+};
+
+enum class LTO {
+    none,
+    thin, // ThinLTO on clang, parallel -flto on gcc
+};
+
+using Tools = std::unordered_map<string, Path>;
+
+// the fastest linker installed that `info` accepts as -fuse-ld: gcc takes lld from 9 and
+// mold from 12.1, clang takes any. `tools` from discover_toolchains, PATH when null
+inline Linker find_linker(const CompilerInfo& info, const Tools* tools = nullptr) {
+    // -fuse-ld=mold looks for ld.mold, a bare mold binary is not enough
+    static const Tools path_tools = [] {
+        Tools found;
+        for (const char* name : {"ld.mold", "ld.lld", "ld.gold"}) {
+            if (auto program = OS::find_program(name)) found.emplace(name, *program);
+        }
+        return found;
+    }();
+    const Tools& installed = tools ? *tools : path_tools;
+
+    int         major = 0;
+    int         minor = 0;
+    string_view version(info.version);
+    auto        dot = std::from_chars(version.data(), version.data() + version.size(), major).ptr;
+    if (dot < version.data() + version.size() && *dot == '.') std::from_chars(dot + 1, version.data() + version.size(), minor);
+    auto accepts = [&](int want_major, int want_minor) {
+        return info.type == CompilerType::clang || std::pair(major, minor) >= std::pair(want_major, want_minor);
+    };
+
+    if (installed.contains("ld.mold") && accepts(12, 1)) return Linker::mold;
+    if (installed.contains("ld.lld") && accepts(9, 0)) return Linker::lld;
+    if (installed.contains("ld.gold")) return Linker::gold;
+    return Linker::system;
+}
+
+class Compiler {
+public:
+    Path                  exe;
+    std::optional<Linker> linker;           // unset picks one with find_linker on first use
+    size_t                link_threads = 0; // 0 means one per core
+    std::optional<Tools>  tools;            // found next to the compiler, unset searches PATH
+
+public:
+    Compiler() = delete;
+    Compiler(Path path) : exe(path) {};
+
+    // the selected linker, system when the compiler can't be queried
+    Linker get_linker() const {
+        if (linker) return *linker;
+        if (!picked) {
+            auto compiler = info();
+            picked        = compiler ? find_linker(*compiler, tools ? &*tools : nullptr) : Linker::system;
+        }
+        return *picked;
+    }
+
+public:
+    // the link step of build_target, `weight` job slots are taken while it runs
+    virtual Task<bool> link_target_async(Path output, std::vector<Path> depfiles, std::vector<string> options = {}, DebugInfo debug = DebugInfo::none, size_t weight = 1) {
+        CmdResult link = co_await spawn(get_link_target_cmd(output, depfiles, options, debug), weight);
+        if (!link.output.empty()) {
+            log_impl::write_record(2, link.output);
+        }
+        co_return link.ok();
+    }
+
+    bool link_target(const Path& output, const std::vector<Path>& depfiles, const std::vector<string>& options = {}, DebugInfo debug = DebugInfo::none) {
+        return sync_wait(link_target_async(output, depfiles, options, debug));
+    }
+
+    // -fuse-ld and the thread count of the selected linker
+    virtual std::vector<string> linker_flags(DebugInfo debug = DebugInfo::none) const {
+        size_t              threads  = link_threads ? link_threads : std::max(1u, std::thread::hardware_concurrency());
+        string              count    = std::to_string(threads);
+        Linker              selected = get_linker();
+        std::vector<string> flags;
+        switch (selected) {
+            case Linker::system: return {};
+            case Linker::bfd: return {"-fuse-ld=bfd"};
+            case Linker::gold: flags = {"-fuse-ld=gold", "-Wl,--threads", "-Wl,--thread-count=" + count}; break;
+            case Linker::lld: flags = {"-fuse-ld=lld", "-Wl,--threads=" + count}; break;
+            case Linker::mold: flags = {"-fuse-ld=mold", "-Wl,--threads=" + count}; break;
+        }
+        if (debug == DebugInfo::split) flags.push_back("-Wl,--gdb-index");
+
+        // gcc only looks for ld.<name> on PATH and in its own libexec, -B points it at the discovered one
+        static constexpr const char* names[] = {"", "ld.bfd", "ld.gold", "ld.lld", "ld.mold"};
+        if (tools) {
+            auto it = tools->find(names[size_t(selected)]);
+            if (it != tools->end()) flags.push_back("-B" + it->second.parent_path().generic_string());
+        }
+        return flags;
+    }
+
+    virtual std::vector<std::string> compile_flag(const Path& unit)                   = 0;
+    virtual std::vector<std::string> out_flag(const Path& unit)                       = 0;
+    virtual std::vector<std::string> dep_flag(const Path& unit, const Path& obj = "") = 0;
+
+    virtual Cmd get_compile_unit_cmd(const Path& input, const Path& output, const OptionBlock& options) {
+        return Cmd(exe, "-c", input, "-o", output, options).AllowResponseFile();
+    }
+
+    virtual Cmd get_link_target_cmd(const Path& output, const std::vector<Path>& depfiles, const std::vector<string>& options = {}, DebugInfo debug = DebugInfo::none) {
+        return Cmd(exe, depfiles, "-o", output, linker_flags(debug), options).AllowResponseFile();
+    }
+
+    virtual Cmd get_compile_and_gendep_unit_cmd(const Path& input, const Path& obj, const Path& dep, const OptionBlock& options) {
+        return Cmd(exe, "-c", input, "-o", obj, "-MMD", "-MF", dep, "-MT", obj, options).AllowResponseFile();
+    }
+
+    // preprocess a header on its own as C++, -H prints every header opened with its nesting depth
+    virtual Cmd get_include_tree_cmd(const Path& header, const OptionBlock& options) {
+#ifdef _WIN32
+        const char* null = "NUL";
+#else
+        const char* null = "/dev/null";
+#endif // _WIN32
+        return Cmd(exe, "-E", "-H", "-o", null, "-x", "c++", header, options).AllowResponseFile();
+    }
+
+    virtual Cmd get_compile_module_cmd(const Path& input, const Path& output, const OptionBlock& options) {
+        return Cmd(exe, "--precompile", "-o", output).AllowResponseFile();
+    }
+
+    virtual std::vector<string> debug_flags(DebugInfo debug) const {
+        switch (debug) {
+            case DebugInfo::none: return {};
+            case DebugInfo::full: return {"-g"};
+            case DebugInfo::split: return {"-g", "-gsplit-dwarf"};
+        }
+        return {};
+    }
+
+    virtual std::vector<string> lto_compile_flags(LTO lto) const { return {}; }
+
+    // `jobs` backend threads, `cache` keeps backend results between links when supported
+    virtual std::vector<string> lto_link_flags(LTO lto, size_t jobs, const Dir& cache) const { return {}; }
+
+    // version, target and system headers of the compiler, from the compiler cache
+    Result<CompilerInfo> info() const {
+        return query_compiler(exe);
+    }
+
+
+    // changes whenever the compiler binary is replaced
+    virtual uint64_t fingerprint() const {
+        if (auto compiler = info()) {
+            return compiler->fingerprint();
+        }
+        OS::FileStat info = OS::stat_file(exe);
+        uint64_t     hash = hash_bytes(exe.generic_string());
+        hash              = hash_combine(hash, info.mtime);
+        return hash_combine(hash, info.size);
+    }
+
+private:
+    mutable std::optional<Linker> picked;
+};
+
+class GNU_Compiler : public Compiler {
+public:
+    // GNU_Compiler(const Path& path) : Compiler(path) {};
+    using Compiler::Compiler;
+
+    virtual std::vector<std::string> compile_flag(const Path& unit) {
+        return {"-c", unit.generic_string()};
+    }
+
+    virtual std::vector<std::string> out_flag(const Path& obj) {
+        return {"-o", obj.generic_string()};
+    }
+
+    virtual std::vector<std::string> dep_flag(const Path& dep, const Path& obj = "") {
+        std::vector<std::string> flags = {"-MMD", "-MF", dep.generic_string()};
+        if (!obj.empty()) {
+            flags.push_back("-MT");
+            flags.push_back(obj.generic_string());
+        }
+
+        return flags;
+    }
+
+    // gcc has no ThinLTO, the closest is partitioned LTO with parallel ltrans jobs
+    virtual std::vector<string> lto_compile_flags(LTO lto) const override {
+        if (lto == LTO::none) return {};
+        return {"-flto"};
+    }
+
+    virtual std::vector<string> lto_link_flags(LTO lto, size_t jobs, const Dir& cache) const override {
+        if (lto == LTO::none) return {};
+        return {"-flto=" + std::to_string(jobs)};
+    }
+};
+
+class Clang : public GNU_Compiler {
+public:
+    using GNU_Compiler::GNU_Compiler;
+    Clang() : GNU_Compiler("clang++") {};
+
+    virtual std::vector<string> lto_compile_flags(LTO lto) const override {
+        if (lto == LTO::none) return {};
+        return {"-flto=thin"};
+    }
+
+    virtual std::vector<string> lto_link_flags(LTO lto, size_t jobs, const Dir& cache) const override {
+        if (lto == LTO::none) return {};
+        string count = std::to_string(jobs);
+        if (get_linker() == Linker::lld) {
+            return {"-flto=thin", "-Wl,--thinlto-jobs=" + count, "-Wl,--thinlto-cache-dir=" + cache.generic_string()};
+        }
+        // gold, mold and bfd go through the LLVM linker plugin
+        return {"-flto=thin", "-Wl,-plugin-opt,jobs=" + count, "-Wl,-plugin-opt,cache-dir=" + cache.generic_string()};
+    }
+
+    std::vector<string> compile_module_option(const Path& uints, const Path& targetdir = ".") {
+        Path targetpath = targetdir / uints.filename().string();
+        targetpath.replace_extension(".pcm");
+        return {uints.generic_string(), "--precompile", "-o", targetpath.string()};
+    }
+
+private:
+};
+
+// the clang/gcc driver a file name runs, also versioned (clang++-17) and cross
+// (aarch64-linux-gnu-g++) ones; empty for anything else
+inline string_view driver_of(string_view name) {
+#ifdef _WIN32
+    if (!name.ends_with(".exe")) return {};
+    name.remove_suffix(4);
+#endif // _WIN32
+    size_t dash = name.rfind('-');
+    if (dash != string_view::npos && dash + 1 < name.size() &&
+        std::all_of(name.begin() + dash + 1, name.end(), [](char c) { return std::isdigit((unsigned char)c) || c == '.'; })) {
+        name = name.substr(0, dash);
+    }
+    for (string_view driver : {"clang++", "g++", "clang", "gcc"}) {
+        if (name == driver) return driver;
+        // the prefix has to look like a triple, e.g. not ccache-g++
+        if (!name.ends_with(driver) || name.size() <= driver.size() + 1 || name[name.size() - driver.size() - 1] != '-') continue;
+        if (name.substr(0, name.size() - driver.size() - 1).find('-') != string_view::npos) return driver;
+    }
+    return {};
+}
+
+struct Discovered {
+    std::vector<CompilerInfo> compilers; // in search order
+    Tools                     tools;     // linkers, archivers and scanners by name
+};
+
+// clang/gcc drivers in `roots`/bin and then PATH, each one queried once and then served
+// from the compiler cache
+inline Discovered discover_toolchains(const std::vector<Dir>& roots = {}, bool search_path = true) {
+    std::vector<Dir> dirs;
+    for (auto& root : roots) { dirs.push_back(root / "bin"); }
+    if (const char* env = std::getenv("PATH"); env && search_path) {
+#ifdef _WIN32
+        constexpr char separator = ';';
+#else
+        constexpr char separator = ':';
+#endif // _WIN32
+        string_view paths = env;
+        while (!paths.empty()) {
+            size_t end = paths.find(separator);
+            if (end != 0) dirs.emplace_back(paths.substr(0, end));
+            paths.remove_prefix(end == string_view::npos ? paths.size() : end + 1);
+        }
+    }
+
+    static constexpr string_view tools[] = {"ld.lld", "ld.mold", "mold", "ld.gold", "llvm-ar", "ar", "llvm-ranlib", "ranlib", "clang-scan-deps"};
+
+    Discovered       found;
+    std::set<string> seen;
+    for (auto& dir : dirs) {
+        OS::DirListing listing = OS::read_dir(dir);
+        std::sort(listing.files.begin(), listing.files.end());
+        for (auto& name : listing.files) {
+            string tool = name;
+#ifdef _WIN32
+            if (tool.ends_with(".exe")) tool.resize(tool.size() - 4);
+#endif // _WIN32
+            if (std::find(std::begin(tools), std::end(tools), tool) != std::end(tools)) {
+                found.tools.try_emplace(tool, dir / name);
+            }
+            if (driver_of(name).empty()) continue;
+
+            // symlinks like clang++ -> clang-17 are the same binary
+            std::error_code ec;
+            Path            real = std::filesystem::canonical(dir / name, ec);
+            if (ec || !seen.insert(real.generic_string()).second) continue;
+
+            auto info = query_compiler(dir / name);
+            if (info) {
+                found.compilers.push_back(std::move(*info));
+            } else {
+                log(WARN, "%s", info.error().c_str());
+            }
+        }
+    }
+    return found;
+}
+
+// `tools` from the same discovery, so the linker is looked up among them and not on PATH again
+inline std::shared_ptr<Compiler> make_compiler(const CompilerInfo& info, const Tools& tools = {}) {
+    std::shared_ptr<Compiler> compiler;
+    if (info.type == CompilerType::clang) {
+        compiler = std::make_shared<Clang>(info.exe);
+    } else {
+        compiler = std::make_shared<GNU_Compiler>(info.exe);
+    }
+    compiler->tools = tools;
+    return compiler;
+}
+
+// the first C++ driver matching `accept`, clang before gcc
+template <typename F>
+inline std::shared_ptr<Compiler> pick_compiler(const Discovered& found, F accept) {
+    const CompilerInfo* best = nullptr;
+    for (auto& info : found.compilers) {
+        if (!driver_of(info.exe.filename().string()).ends_with("++") || !accept(info)) continue;
+        if (!best || (best->type != CompilerType::clang && info.type == CompilerType::clang)) best = &info;
+    }
+    return best ? make_compiler(*best, found.tools) : nullptr;
+}
+
+// a C++ compiler installed below `dir`
+inline std::shared_ptr<Compiler> find_compiler(const Dir& dir) {
+    auto compiler = pick_compiler(discover_toolchains({dir}, false), [](auto&) { return true; });
+    if (!compiler) throw std::runtime_error("undetected compiler.");
+    return compiler;
+}
+
+// a C++ compiler from PATH
+inline std::shared_ptr<Compiler> find_compiler() {
+    auto compiler = pick_compiler(discover_toolchains(), [](auto&) { return true; });
+    if (!compiler) throw std::runtime_error("undetected compiler.");
+    return compiler;
+}
+
+// a C++ compiler that targets `triple` by default, e.g. aarch64-linux-gnu-g++ for a cross Variant
+inline std::shared_ptr<Compiler> find_cross_compiler(string_view triple, const std::vector<Dir>& roots = {}) {
+    auto compiler = pick_compiler(discover_toolchains(roots), [&](const CompilerInfo& info) { return info.triple == triple; });
+    if (!compiler) throw std::runtime_error("undetected compiler for " + string(triple) + ".");
+    return compiler;
+}
+
+class ToolChain {
+public:
+    Dir base;
+
+public:
+    ToolChain() = delete;
+
+    ToolChain(const Dir& path) : base(path) {};
+
+    virtual ~ToolChain() = default;
+
+    virtual Dir  get_stdlib_dir() const                                                         = 0;
+    virtual bool scan_module_dep(const Path& input, const std::vector<string>& compile_command) = 0;
+
+private:
+};
+
+class LLVM_MinGW : public ToolChain {
+public:
+    using ToolChain::ToolChain;
+
+    virtual Dir get_stdlib_dir() const override {
+        return base / "share" / "libc++" / "v1";
+    }
+
+    virtual bool scan_module_dep(const Path& input, const std::vector<string>& compile_command) override {
+        Cmd cmd(base / "bin" / "clang-scan-deps", "--format=p1689", "--", compile_command);
+        return run_cmd(cmd);
     }
 
 private:
@@ -535,11 +2224,14 @@ private:
 
 } // namespace ToolChain
 
-// TODO: implenment it
-inline ToolChain::ToolChain find_ToolChain(const Dir& dir) {
-    Path path = dir / "bin" / "clang++.exe";
-    if (std::filesystem::exists(path)) {
-        return ToolChain::LLVM_MinGW(dir);
+// the toolchain installed below `dir`, told apart by what its compiler targets
+inline std::shared_ptr<ToolChain::ToolChain> find_ToolChain(const Dir& dir) {
+    auto found = ToolChain::discover_toolchains({dir}, false);
+    for (auto& info : found.compilers) {
+        bool mingw = info.triple.find("mingw") != string::npos || info.triple.find("windows-gnu") != string::npos;
+        if (info.type == ToolChain::CompilerType::clang && mingw) {
+            return std::make_shared<ToolChain::LLVM_MinGW>(dir);
+        }
     }
 
     throw std::runtime_error("unknown toolchain");
@@ -599,6 +2291,95 @@ private:
     }
 };
 
+// what a target was last built from: a fingerprint of its configuration plus a
+// flat, sorted list of every file in its dependency closure and its outputs
+class Manifest {
+public:
+    uint64_t                                   fingerprint = 0;
+    std::vector<Path>                          objs; // in unit order
+    std::vector<std::pair<Path, OS::FileStat>> files;
+
+public:
+    static Result<Manifest> load(const Path& path) {
+        Manifest manifest;
+        string   error;
+
+        auto next_field = [](string_view& line) {
+            size_t      space = line.find(' ');
+            string_view field = line.substr(0, space);
+            line.remove_prefix(space == string_view::npos ? line.size() : space + 1);
+            return field;
+        };
+        auto to_int = [](string_view field, auto& value, int base = 10) {
+            return std::from_chars(field.data(), field.data() + field.size(), value, base).ec == std::errc();
+        };
+
+        bool header = false;
+        bool read   = OS::read_lines(path, [&](string_view line) {
+            if (!error.empty()) return;
+            string_view kind = next_field(line);
+            if (kind == "csc-manifest") {
+                header = line == "1";
+            } else if (kind == "fingerprint") {
+                if (!to_int(line, manifest.fingerprint, 16)) error = "bad manifest fingerprint";
+            } else if (kind == "obj") {
+                manifest.objs.emplace_back(line);
+            } else if (kind == "file") {
+                OS::FileStat info;
+                info.exists = true;
+                if (!to_int(next_field(line), info.mtime) || !to_int(next_field(line), info.size)) {
+                    error = "bad manifest entry";
+                    return;
+                }
+                manifest.files.emplace_back(Path(line), info);
+            } else if (!kind.empty()) {
+                error = "unknown manifest entry";
+            }
+        });
+        if (!read) return Reason("failed to open file! [\"" + path.string() + "\"]");
+        if (!error.empty()) return Reason(error);
+        if (!header) return Reason("unknown manifest version");
+        return manifest;
+    }
+
+    bool save(const Path& path) const {
+        string content = "csc-manifest 1\n";
+        char   buffer[32];
+
+        content += "fingerprint ";
+        content.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), fingerprint, 16).ptr);
+        content += "\n";
+        for (auto& obj : objs) {
+            content += "obj " + obj.generic_string() + "\n";
+        }
+        for (auto& [file, info] : files) {
+            content += "file " + std::to_string(info.mtime) + " " + std::to_string(info.size) + " " + file.generic_string() + "\n";
+        }
+        return OS::write_file(path, content);
+    }
+
+    // record the current state of `paths`, sorted so the next check walks directories in order
+    void record(std::vector<Path> paths) {
+        std::sort(paths.begin(), paths.end());
+        paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+        files.clear();
+        files.reserve(paths.size());
+        for (auto& path : paths) {
+            files.emplace_back(std::move(path), OS::FileStat{});
+            files.back().second = OS::stat_file(files.back().first);
+        }
+    }
+
+    // one stat per recorded file, nothing else
+    bool up_to_date(uint64_t expect) const {
+        if (fingerprint != expect || files.empty()) return false;
+        for (auto& [file, info] : files) {
+            if (OS::stat_file(file) != info) return false;
+        }
+        return true;
+    }
+};
+
 inline Result<bool> update_self(int argc, char** argv, const Path& source_path, const std::vector<Path>& other_path = {}) {
     Path binary_path(argv[0]);
 #ifdef _WIN32
@@ -637,7 +2418,7 @@ inline Result<bool> update_self(int argc, char** argv, const Path& source_path,
 }
 
 // check success?
-inline bool check_dep_file(const Unit& unit, const Path& dep_path, const Path& obj, Graph* graph = nullptr) {
+inline bool check_dep_file(const Unit& unit, const Path& dep_path, const Path& obj, Graph* graph = nullptr, StatCache* stats = nullptr) {
     if (!std::filesystem::exists(dep_path)) { return false; }
     auto result = parse_dep_file(dep_path);
     if (!result) {
@@ -648,46 +2429,296 @@ inline bool check_dep_file(const Unit& unit, const Path& dep_path, const Path& o
         graph->add_depinfo(dep_info, unit);
     }
 
-    return !is_outdated(obj, dep_info.depends);
+    return !is_outdated(obj, dep_info.depends, stats);
 }
 
-inline bool compile_translation_unit(ToolChain::Compiler& compiler, Unit& unit, const Dir& out_dir = "build", std::vector<string> options = {}, Graph* graph = nullptr) {
-    Path out_name = out_dir / unit.path.filename();
-    Path obj      = out_dir / unit.path.filename();
+// the command that brings the unit up to date, nullopt when it already is
+inline std::optional<Cmd> prepare_translation_unit(ToolChain::Compiler& compiler, Unit& unit, const Dir& out_dir = "build", const OptionBlock& options = nullptr, Graph* graph = nullptr, bool force = false, StatCache* stats = nullptr, string_view tag = {}) {
+    Path obj = out_dir / unit.path.filename();
     obj.replace_extension(".o");
     Path dep = obj;
     dep.replace_extension(".d");
     unit.obj = obj;
 
-    // TODO: generate_dependence maybe different by options,should add cache to diff
-
-    bool need_rebuild = !std::filesystem::exists(obj) || !check_dep_file(unit, dep, obj, graph);
+    bool need_rebuild = force || !std::filesystem::exists(obj) || !check_dep_file(unit, dep, obj, graph, stats);
     if (!need_rebuild) {
-        return true;
+        return std::nullopt;
     }
 
-    log(INFO, "%s need to rebuild.", unit.path.string().c_str());
-    bool result = false;
+    log(INFO, "%s%.*s need to rebuild.", unit.path.string().c_str(), int(tag.size()), tag.data());
     std::filesystem::create_directories(out_dir);
-    Cmd cmd;
 
     if (unit.is_module()) {
-        cmd = compiler.get_compile_module_cmd(unit.path, obj, options);
-    } else {
-        if (graph) {
-            cmd = compiler.get_compile_and_gendep_unit_cmd(unit.path, obj, dep, options);
-        } else {
-            cmd = compiler.get_compile_unit_cmd(unit.path, obj, options);
+        return compiler.get_compile_module_cmd(unit.path, obj, options);
+    }
+    if (graph) {
+        return compiler.get_compile_and_gendep_unit_cmd(unit.path, obj, dep, options);
+    }
+    return compiler.get_compile_unit_cmd(unit.path, obj, options);
+}
+
+inline bool compile_translation_unit(ToolChain::Compiler& compiler, Unit& unit, const Dir& out_dir = "build", const OptionBlock& options = nullptr, Graph* graph = nullptr) {
+    std::optional<Cmd> cmd = prepare_translation_unit(compiler, unit, out_dir, options, graph);
+    if (!cmd) {
+        return true;
+    }
+    // log(CODE, cmd->GetCommandStr());
+    return run_cmd(*cmd);
+}
+
+// coroutine parameters outlive the caller's temporaries, so take them by value
+inline Task<bool> compile_translation_unit_async(ToolChain::Compiler& compiler, Unit& unit, Dir out_dir, OptionBlock options, Graph* graph = nullptr, bool force = false, StatCache* stats = nullptr, string tag = {}) {
+    std::optional<Cmd> cmd = prepare_translation_unit(compiler, unit, out_dir, options, graph, force, stats, tag);
+    if (!cmd) {
+        co_return true;
+    }
+    CmdResult result = co_await spawn(std::move(*cmd));
+    if (result.ok()) unit.seconds = result.seconds;
+    unit.failed = !result.ok() && !result.cancelled;
+    if (!result.output.empty()) {
+        log_impl::write_record(2, result.output);
+    }
+    co_return result.ok();
+}
+
+// drop files older than `max_age`, then the oldest ones until the directory fits in `max_bytes`
+inline void prune_cache(const Dir& dir, uint64_t max_bytes, std::chrono::seconds max_age) {
+    std::error_code                             ec;
+    std::vector<std::pair<Path, OS::FileStat>> files;
+    for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        OS::FileStat info = OS::stat_file(it->path());
+        if (info.exists && it->is_regular_file(ec)) files.emplace_back(it->path(), info);
+    }
+    std::sort(files.begin(), files.end(), [](auto& a, auto& b) { return a.second.mtime > b.second.mtime; });
+
+    auto     now   = std::chrono::system_clock::now().time_since_epoch();
+    int64_t  limit = std::chrono::duration_cast<std::chrono::nanoseconds>(now - max_age).count();
+    uint64_t total = 0;
+    for (auto& [file, info] : files) {
+        total += info.size;
+        if (info.mtime < limit || total > max_bytes) {
+            std::filesystem::remove(file, ec);
         }
     }
+}
 
-    // log(CODE, cmd.GetCommandStr());
-    return run_cmd(cmd);
+// `*` and `?` stay within one path segment, `**` spans any number of them
+inline bool glob_match(string_view pattern, string_view path) {
+    if (pattern.starts_with("**")) {
+        string_view rest = pattern.substr(2);
+        if (rest.starts_with('/')) rest.remove_prefix(1);
+        if (rest.empty() || glob_match(rest, path)) return true;
+        for (size_t i = 0; i < path.size(); ++i) {
+            if (path[i] == '/' && glob_match(rest, path.substr(i + 1))) return true;
+        }
+        return false;
+    }
+    if (pattern.empty()) return path.empty();
+
+    if (pattern.front() == '*') {
+        for (size_t i = 0; i <= path.size(); ++i) {
+            if (glob_match(pattern.substr(1), path.substr(i))) return true;
+            if (i < path.size() && path[i] == '/') break;
+        }
+        return false;
+    }
+    if (path.empty()) return false;
+    if (pattern.front() == '?' ? path.front() == '/' : pattern.front() != path.front()) return false;
+    return glob_match(pattern.substr(1), path.substr(1));
+}
+
+// directory listings of the last walk, a directory is only read again when its mtime changed
+class DirCache {
+public:
+    std::unordered_map<string, OS::DirListing> dirs;
+    // set by walk when a listing was read or dropped, save skips a clean cache
+    bool dirty = false;
+
+public:
+    static DirCache load(const Path& path) {
+        DirCache cache;
+
+        // "d <mtime> <dir>" followed by "f <name>" and "s <name>" lines
+        OS::DirListing* current = nullptr;
+        bool            bad     = false;
+        OS::read_lines(path, [&](string_view line) {
+            if (bad || line.size() < 2) return;
+            string_view value = line.substr(2);
+            if (line[0] == 'd') {
+                size_t  space = value.find(' ');
+                int64_t mtime = 0;
+                if (space == string_view::npos || std::from_chars(value.data(), value.data() + space, mtime).ec != std::errc()) {
+                    bad = true;
+                    return;
+                }
+                current        = &cache.dirs[string(value.substr(space + 1))];
+                current->mtime = mtime;
+            } else if (current && line[0] == 'f') {
+                current->files.emplace_back(value);
+            } else if (current && line[0] == 's') {
+                current->dirs.emplace_back(value);
+            }
+        });
+        return bad ? DirCache() : cache;
+    }
+
+    bool save(const Path& path) const {
+        if (!dirty) return true;
+        string content;
+        for (auto& [dir, listing] : dirs) {
+            content += "d " + std::to_string(listing.mtime) + " " + dir + "\n";
+            for (auto& file : listing.files) { content += "f " + file + "\n"; }
+            for (auto& sub : listing.dirs) { content += "s " + sub + "\n"; }
+        }
+        return OS::write_file(path, content);
+    }
+
+    // every regular file below `roots`, relative to `base`; subtrees are walked in parallel.
+    // `depths[i]` limits how many levels below `roots[i]` are read, none or SIZE_MAX walks all.
+    // directories in the walked range that no longer exist are dropped from the cache
+    std::vector<string> walk(const Dir& base, const std::vector<string>& roots, const std::vector<string>& skip = {}, const std::vector<size_t>& depths = {}) {
+        auto depth_of = [&](size_t i) { return i < depths.size() ? depths[i] : SIZE_MAX; };
+
+        // each directory with the number of levels that may still be read below it
+        std::unordered_map<string, OS::DirListing> seen;
+        std::vector<string>                        files;
+        std::deque<std::pair<string, size_t>>      queue;
+        std::mutex                                 mutex;
+        std::condition_variable                    cv;
+        size_t                                     busy = 0;
+        for (size_t i = 0; i < roots.size(); ++i) { queue.emplace_back(roots[i], depth_of(i)); }
+
+        auto worker = [&] {
+            std::unique_lock lock(mutex);
+            while (true) {
+                cv.wait(lock, [&] { return !queue.empty() || busy == 0; });
+                if (queue.empty()) return;
+                auto [rel, depth] = std::move(queue.front());
+                queue.pop_front();
+                ++busy;
+                lock.unlock();
+
+                Dir          dir  = rel.empty() ? base : base / rel;
+                OS::FileStat info = OS::stat_file(dir);
+
+                OS::DirListing listing;
+                bool           cached = false;
+                if (info.exists) {
+                    lock.lock();
+                    auto it = dirs.find(rel);
+                    if (it != dirs.end() && it->second.mtime == info.mtime) {
+                        listing = it->second;
+                        cached  = true;
+                    }
+                    lock.unlock();
+                    if (!cached) {
+                        listing       = OS::read_dir(dir);
+                        listing.mtime = info.mtime;
+                    }
+                }
+
+                lock.lock();
+                dirty         = dirty || !cached;
+                string prefix = rel.empty() ? "" : rel + "/";
+                for (auto& file : listing.files) { files.push_back(prefix + file); }
+                for (auto& sub : listing.dirs) {
+                    string child = prefix + sub;
+                    if (depth == 0 || sub.front() == '.' || std::find(skip.begin(), skip.end(), child) != skip.end()) continue;
+                    queue.emplace_back(std::move(child), depth == SIZE_MAX ? depth : depth - 1);
+                }
+                if (info.exists) seen[rel] = std::move(listing);
+                --busy;
+                cv.notify_all();
+            }
+        };
+
+        size_t                   count = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < count; ++i) { threads.emplace_back(worker); }
+        worker();
+        for (auto& thread : threads) { thread.join(); }
+
+        auto walked = [&](const string& dir) {
+            for (size_t i = 0; i < roots.size(); ++i) {
+                const string& root = roots[i];
+                if (!root.empty() && dir != root && !dir.starts_with(root + "/")) continue;
+                string_view below = string_view(dir).substr(root.empty() ? 0 : root.size());
+                size_t      level = dir.empty() || dir == root ? 0 : std::count(below.begin(), below.end(), '/') + root.empty();
+                if (level <= depth_of(i)) return true;
+            }
+            return false;
+        };
+        std::erase_if(dirs, [&](const auto& entry) {
+            if (!walked(entry.first)) return false;
+            dirty = dirty || !seen.contains(entry.first);
+            return true;
+        });
+        dirs.merge(seen);
+        std::sort(files.begin(), files.end());
+        files.erase(std::unique(files.begin(), files.end()), files.end());
+        return files;
+    }
+};
+
+// files under `root` matching any of `include` and none of `exclude`, patterns are relative to `root`
+inline std::vector<Path> discover_sources(const Dir& root, const Path& cache_path, const std::vector<string>& include, const std::vector<string>& exclude = {}, const std::vector<string>& extensions = {}, const std::vector<string>& skip = {}) {
+    // only walk below the literal directories the patterns start with
+    std::vector<string> roots;
+    for (auto& pattern : include) {
+        size_t wildcard = pattern.find_first_of("*?");
+        size_t slash    = pattern.rfind('/', wildcard);
+        roots.push_back(slash == string::npos ? "" : pattern.substr(0, slash));
+    }
+    std::sort(roots.begin(), roots.end());
+    roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+    std::erase_if(roots, [&](const string& dir) {
+        return std::any_of(roots.begin(), roots.end(), [&](const string& other) {
+            return other != dir && (other.empty() || dir.starts_with(other + "/"));
+        });
+    });
+
+    // and no deeper than the patterns below each root can reach, unless one has `**`
+    std::vector<size_t> depths(roots.size(), 0);
+    for (auto& pattern : include) {
+        size_t slashes = std::count(pattern.begin(), pattern.end(), '/');
+        for (size_t i = 0; i < roots.size(); ++i) {
+            const string& dir = roots[i];
+            if (!dir.empty() && !pattern.starts_with(dir + "/")) continue;
+            if (pattern.find("**") != string::npos) {
+                depths[i] = SIZE_MAX;
+            } else if (depths[i] != SIZE_MAX) {
+                size_t levels = dir.empty() ? 0 : std::count(dir.begin(), dir.end(), '/') + 1;
+                depths[i]     = std::max(depths[i], slashes - levels);
+            }
+        }
+    }
+
+    DirCache            cache = DirCache::load(cache_path);
+    std::vector<string> files = cache.walk(root, roots, skip, depths);
+    if (!cache.save(cache_path)) {
+        log(WARN, "could not write directory cache %s.", cache_path.generic_string().c_str());
+    }
+
+    std::vector<Path> sources;
+    for (auto& file : files) {
+        auto matches = [&](const string& pattern) { return glob_match(pattern, file); };
+        if (!extensions.empty()) {
+            string_view ext = file;
+            size_t      dot = ext.rfind('.');
+            ext             = dot == string_view::npos || ext.find('/', dot) != string_view::npos ? "" : ext.substr(dot);
+            if (std::find(extensions.begin(), extensions.end(), ext) == extensions.end()) continue;
+        }
+        if (std::any_of(include.begin(), include.end(), matches) && std::none_of(exclude.begin(), exclude.end(), matches)) {
+            sources.push_back((root / file).lexically_normal());
+        }
+    }
+    return sources;
 }
 
 } // namespace build
 
 class Target {
+public:
     enum class Type {
         exe,
         static_lib,
@@ -710,6 +2741,49 @@ class Target {
         cpp26,
     };
 
+    // one configuration of the target, built into its own directory below `build`
+    struct Variant {
+        string              name;
+        std::vector<string> options;
+        std::vector<string> link_options;
+
+        std::optional<Architecture> architecture;
+        // e.g. a cross gcc, the compiler passed to the build otherwise
+        std::shared_ptr<ToolChain::Compiler> compiler;
+
+        static Variant debug() { return {"debug", {"-O0", "-g"}}; }
+
+        static Variant release() { return {"release", {"-O2", "-DNDEBUG"}}; }
+
+        static Variant asan() {
+            return {"asan", {"-O1", "-g", "-fsanitize=address", "-fno-omit-frame-pointer"}, {"-fsanitize=address"}};
+        }
+
+        // --target=<triple>, understood by clang; gcc needs a cross `compiler` instead
+        static Variant arch(Architecture architecture) {
+            string triple = get_triple(architecture);
+            return {triple, {"--target=" + triple}, {"--target=" + triple}, architecture};
+        }
+    };
+
+    static string get_triple(Architecture architecture) {
+        switch (architecture) {
+#ifdef _WIN32
+            case Architecture::x86_64: return "x86_64-w64-windows-gnu";
+            case Architecture::aarch64: return "aarch64-w64-windows-gnu";
+            case Architecture::armv7: return "armv7-w64-windows-gnu";
+            case Architecture::i686: return "i686-w64-windows-gnu";
+#else
+            case Architecture::x86_64: return "x86_64-linux-gnu";
+            case Architecture::aarch64: return "aarch64-linux-gnu";
+            case Architecture::armv7: return "armv7-linux-gnueabihf";
+            case Architecture::i686: return "i686-linux-gnu";
+#endif // _WIN32
+            case Architecture::arm64ec: return "arm64ec-pc-windows-msvc";
+        }
+        return "unknown";
+    }
+
 public:
     Dir    root  = ".";
     Dir    build = "build";
@@ -719,17 +2793,64 @@ public:
     CppVersion   version      = CppVersion::cpp23;
     Architecture architecture = Architecture::x86_64;
 
+    ToolChain::DebugInfo debug_info = ToolChain::DebugInfo::none;
+    ToolChain::LTO       lto        = ToolChain::LTO::none;
+
+    // backend threads of the LTO link, 0 means EventLoop::jobs
+    size_t lto_jobs = 0;
+    // the LTO cache is pruned to this size and age after every link
+    uint64_t             lto_cache_size = uint64_t(4) << 30;
+    std::chrono::seconds lto_cache_age  = std::chrono::hours(24 * 7);
+
     std::set<string>  options;
     std::vector<Unit> units;
 
+    // built side by side by build_variants, each into build / variant.name
+    std::vector<Variant> variants;
+    // set on the copies made by with_variant
+    std::optional<Variant> variant;
+
     build::Graph graph;
 
+private:
+    mutable OptionBlock option_block;
+
 public:
     Target(const string& str) :
     name{str} {};
 
     void add_translation_units(const std::vector<Unit>& files) { units.append_range(files); };
 
+    void add_variant(Variant variant) { variants.push_back(std::move(variant)); }
+
+    Target with_variant(const Variant& config) const {
+        Target copy = *this;
+        copy.variants.clear();
+        copy.variant = config;
+        copy.build   = build / config.name;
+        if (config.architecture) copy.architecture = *config.architecture;
+        return copy;
+    }
+
+    // " [debug]" on a variant copy, so log lines of one matrix build can be told apart
+    string variant_tag() const {
+        return variant ? " [" + variant->name + "]" : string();
+    }
+
+    // e.g. add_sources({"src/**/*.cpp"}, {"src/**/*_test.cpp"}), units already added are kept once
+    void add_sources(const std::vector<string>& include, const std::vector<string>& exclude = {}, const std::vector<string>& extensions = {}) {
+        std::error_code     ec;
+        std::vector<string> skip;
+        Path                out = std::filesystem::relative(build, root, ec);
+        if (!ec && !out.empty() && *out.begin() != ".." && out != ".") skip.push_back(out.generic_string());
+
+        std::set<Path> known;
+        for (auto& unit : units) { known.insert(unit.path.lexically_normal()); }
+        for (auto& source : build::discover_sources(root, build / (name + ".dircache"), include, exclude, extensions, skip)) {
+            if (known.insert(source).second) units.emplace_back(source);
+        }
+    }
+
     Path get_target_path(const Dir& out_dir = "") const {
         if (out_dir.empty()) {
             return build / (name + ".exe");
@@ -737,6 +2858,64 @@ public:
         return out_dir / (name + ".exe");
     }
 
+    Path get_manifest_path() const {
+        return build / (name + ".manifest");
+    }
+
+    // hash of the flags each unit's object was last compiled with
+    Path get_flags_path() const {
+        return build / (name + ".flags");
+    }
+
+    Path get_times_path() const {
+        return build / (name + ".times");
+    }
+
+    Path get_failed_path() const {
+        return build / (name + ".failed");
+    }
+
+    // include closure of every header HeaderReport scanned
+    Path get_includes_path() const {
+        return build / (name + ".includes");
+    }
+
+    // where build_target puts the object of `unit`, its .d file sits beside it
+    Path get_obj_path(const Unit& unit) const {
+        Dir  relative = std::filesystem::relative(unit.path.parent_path(), root);
+        Path obj      = (build / relative).lexically_normal() / unit.path.filename();
+        obj.replace_extension(".o");
+        return obj;
+    }
+
+    uint64_t compile_fingerprint(const ToolChain::Compiler& compiler) const {
+        uint64_t hash = compiler.fingerprint();
+        for (auto& option : *get_option_block(compiler)) {
+            hash = hash_combine(hash_bytes(option, hash), option.size());
+        }
+        return hash;
+    }
+
+    // everything that decides how the target is built, except file contents
+    uint64_t fingerprint(const ToolChain::Compiler& compiler) const {
+        uint64_t hash = hash_bytes(name);
+        hash          = hash_combine(hash, uint64_t(type));
+        hash          = hash_combine(hash, uint64_t(version));
+        hash          = hash_combine(hash, uint64_t(architecture));
+        hash          = hash_bytes(root.generic_string(), hash);
+        hash          = hash_bytes(build.generic_string(), hash);
+        hash          = hash_combine(hash, compile_fingerprint(compiler));
+        hash          = hash_combine(hash, uint64_t(compiler.get_linker()));
+        hash          = hash_combine(hash, uint64_t(debug_info));
+        for (auto& option : get_link_options(compiler)) {
+            hash = hash_combine(hash_bytes(option, hash), option.size());
+        }
+        for (auto& unit : units) {
+            hash = hash_combine(hash_bytes(unit.path.native(), hash), unit.is_module());
+        }
+        return hash;
+    }
+
     std::vector<Path> obj_files() const {
         std::vector<Path> objs;
         objs.reserve(units.size());
@@ -750,6 +2929,45 @@ public:
         return {options.begin(), options.end()};
     }
 
+    // compile flags implied by the target settings rather than listed in `options`
+    std::vector<string> get_derived_options(const ToolChain::Compiler& compiler) const {
+        std::vector<string> flags     = compiler.debug_flags(debug_info);
+        std::vector<string> lto_flags = compiler.lto_compile_flags(lto);
+        flags.append_range(lto_flags);
+        if (variant) flags.append_range(variant->options);
+        return flags;
+    }
+
+    Dir get_lto_cache_dir() const {
+        return build / (name + ".ltocache");
+    }
+
+    size_t get_lto_jobs() const {
+        size_t limit = std::max<size_t>(EventLoop::current().jobs, 1);
+        return lto_jobs ? std::min(lto_jobs, limit) : limit;
+    }
+
+    // flags for the link step besides objects, output and linker selection
+    std::vector<string> get_link_options(const ToolChain::Compiler& compiler) const {
+        std::vector<string> flags = compiler.lto_link_flags(lto, get_lto_jobs(), get_lto_cache_dir());
+        if (variant) flags.append_range(variant->link_options);
+        return flags;
+    }
+
+    // shared by the command of every unit, rebuilt only when the options changed
+    OptionBlock get_option_block(const ToolChain::Compiler& compiler) const {
+        std::vector<string> derived = get_derived_options(compiler);
+        bool                same    = option_block && option_block->size() == options.size() + derived.size() &&
+                      std::equal(options.begin(), options.end(), option_block->begin()) &&
+                      std::equal(derived.begin(), derived.end(), option_block->begin() + options.size());
+        if (!same) {
+            std::vector<string> all = get_options();
+            all.append_range(derived);
+            option_block = make_option_block(std::move(all));
+        }
+        return option_block;
+    }
+
     void add_options(string_view str) {
         options.insert(string(str));
     }
@@ -762,6 +2980,8 @@ public:
     Dir    build;
 
     std::vector<Target> targets;
+    // applied to every target that has no variants of its own
+    std::vector<Target::Variant> variants;
 
 public:
     Project() :
@@ -797,21 +3017,928 @@ public:
     }
 };
 
-inline bool build_target(ToolChain::Compiler& compiler, Target& target) {
+namespace build {
+inline bool is_noop(const ToolChain::Compiler& compiler, Target& target) {
+    auto manifest = Manifest::load(target.get_manifest_path());
+    if (!manifest || manifest->objs.size() != target.units.size()) return false;
+    if (!manifest->up_to_date(target.fingerprint(compiler))) return false;
+
+    for (size_t i = 0; i < target.units.size(); ++i) {
+        target.units[i].obj = std::move(manifest->objs[i]);
+    }
+    return true;
+}
+
+inline bool write_manifest(const ToolChain::Compiler& compiler, const Target& target) {
+    Manifest          manifest;
+    std::vector<Path> paths;
+    manifest.fingerprint = target.fingerprint(compiler);
+    manifest.objs        = target.obj_files();
+
+    // inputs of every unit as [begin, end) into `paths`
+    std::vector<std::pair<size_t, size_t>> inputs;
     for (auto& unit : target.units) {
-        Dir relative = std::filesystem::relative(unit.path.parent_path(), target.root);
-        Dir out_dir  = (target.build / relative).lexically_normal();
+        size_t begin = paths.size();
+        paths.push_back(unit.path);
+        Path dep = unit.obj;
+        dep.replace_extension(".d");
+        if (std::filesystem::exists(dep)) {
+            if (auto dep_info = parse_dep_file(dep)) {
+                paths.append_range(dep_info->depends);
+            }
+        }
+        inputs.emplace_back(begin, paths.size());
+        paths.push_back(unit.obj);
+    }
+    paths.push_back(target.get_target_path());
+    // .d files spell the same header differently (src/a.h, src/sub/../a.h), keep one entry each
+    for (auto& path : paths) { path = path.lexically_normal(); }
+    std::vector<Path> all = paths;
+    manifest.record(std::move(all));
+
+    // the stats are taken after the link, an input edited since its compile would pass
+    // as up to date next time, so leave the check to the per-unit dep files instead
+    auto stat_of = [&](const Path& path) {
+        auto it = std::lower_bound(manifest.files.begin(), manifest.files.end(), path, [](auto& file, const Path& p) { return file.first < p; });
+        return it != manifest.files.end() && it->first == path ? it->second : OS::FileStat{};
+    };
+    for (size_t i = 0; i < target.units.size(); ++i) {
+        int64_t built = stat_of(target.units[i].obj.lexically_normal()).mtime;
+        for (size_t j = inputs[i].first; j < inputs[i].second; ++j) {
+            if (stat_of(paths[j]).mtime <= built) continue;
+            log(INFO, "%s changed during the build, no manifest for %s%s.", paths[j].generic_string().c_str(), target.name.c_str(), target.variant_tag().c_str());
+            return true;
+        }
+    }
+    return manifest.save(target.get_manifest_path());
+}
 
-        if (!build::compile_translation_unit(compiler, unit, out_dir, target.get_options(), &target.graph)) {
-            log(ERRO, "compile %s failed.", unit.path.generic_string().c_str());
-            // continue;
-            return false;
+// last measured compile time of each unit, by source path
+inline std::unordered_map<string, double> load_compile_times(const Path& path) {
+    std::unordered_map<string, double> times;
+
+    // "<seconds> <path>" per line
+    OS::read_lines(path, [&](string_view line) {
+        size_t space   = line.find(' ');
+        double seconds = 0;
+        if (space == string_view::npos) return;
+        if (std::from_chars(line.data(), line.data() + space, seconds).ec != std::errc()) return;
+        times[string(line.substr(space + 1))] = seconds;
+    });
+    return times;
+}
+
+// compile fingerprint each unit's object was built with, by source path
+inline std::unordered_map<string, uint64_t> load_unit_flags(const Path& path) {
+    std::unordered_map<string, uint64_t> flags;
+
+    // "<hex fingerprint> <path>" per line
+    OS::read_lines(path, [&](string_view line) {
+        size_t   space = line.find(' ');
+        uint64_t hash  = 0;
+        if (space == string_view::npos) return;
+        if (std::from_chars(line.data(), line.data() + space, hash, 16).ec != std::errc()) return;
+        flags[string(line.substr(space + 1))] = hash;
+    });
+    return flags;
+}
+
+inline bool save_unit_flags(const Path& path, const std::unordered_map<string, uint64_t>& flags) {
+    string content;
+    char   buffer[32];
+    for (auto& [unit, hash] : flags) {
+        content.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), hash, 16).ptr);
+        content += " " + unit + "\n";
+    }
+    return OS::write_file(path, content);
+}
+
+// sources whose compile failed in the last build, one path per line
+inline std::set<string> load_failed_units(const Path& path) {
+    std::set<string> failed;
+    OS::read_lines(path, [&](string_view line) {
+        if (!line.empty()) failed.emplace(line);
+    });
+    return failed;
+}
+
+// last failures first, then the most recently edited sources
+inline std::vector<size_t> schedule_units(const Target& target, const std::set<string>& failed, StatCache* stats = nullptr) {
+    std::vector<std::pair<bool, int64_t>> keys;
+    std::vector<size_t>                   order(target.units.size());
+    keys.reserve(target.units.size());
+    for (size_t i = 0; i < target.units.size(); ++i) {
+        const Path& path = target.units[i].path;
+        order[i]         = i;
+        keys.emplace_back(failed.contains(path.generic_string()), stats ? stats->get(path).mtime : OS::stat_file(path).mtime);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (keys[a].first != keys[b].first) return keys[a].first;
+        return keys[a].second > keys[b].second;
+    });
+    return order;
+}
+
+// units that were not compiled this time keep their previous measurement
+inline void record_compile_times(const Target& target) {
+    auto times   = load_compile_times(target.get_times_path());
+    bool changed = false;
+    for (auto& unit : target.units) {
+        if (unit.seconds <= 0) continue;
+        times[unit.path.generic_string()] = unit.seconds;
+        changed                           = true;
+    }
+    if (!changed) return;
+
+    string content;
+    for (auto& [path, seconds] : times) { content += std::to_string(seconds) + " " + path + "\n"; }
+    if (!OS::write_file(target.get_times_path(), content)) {
+        log(WARN, "could not write %s.", target.get_times_path().generic_string().c_str());
+    }
+}
+
+struct HeaderCost {
+    Path     path;
+    uint64_t bytes         = 0;
+    size_t   units         = 0; // translation units that include it, directly or not
+    size_t   closure_files = 0; // itself and everything it includes, directly or not
+    uint64_t closure_bytes = 0;
+    double   blast_seconds = 0; // compile time of every unit that rebuilds when it changes
+
+    // bytes the compiler reads because of this header, over the whole target
+    uint64_t parsed_bytes() const {
+        return closure_bytes * units;
+    }
+};
+
+// which headers cost the most across a target, from the include tree of every unit
+class HeaderReport {
+public:
+    std::vector<HeaderCost> headers; // most expensive first
+    size_t                  units         = 0;
+    double                  total_seconds = 0; // 0 when no compile times were recorded
+
+public:
+    static HeaderReport analyze(ToolChain::Compiler& compiler, const Target& target, bool weighted = true) {
+        return sync_wait(analyze_async(compiler, target, weighted));
+    }
+
+    // units and blast radius come from the .d files of the last build, so build the target
+    // first. each header is preprocessed once on its own for its closure, include guards
+    // can't hide an edge that way; closures are kept in get_includes_path() until a file
+    // in them changes. measured compile times weight the blast radius when `weighted`
+    static Task<HeaderReport> analyze_async(ToolChain::Compiler& compiler, const Target& target, bool weighted = true) {
+        HeaderReport report;
+        StatCache    stats;
+
+        std::unordered_map<string, double> times;
+        if (weighted) times = load_compile_times(target.get_times_path());
+
+        std::unordered_map<string, size_t> index;
+        std::vector<Path>                  paths;
+        std::vector<size_t>                including;
+        std::vector<double>                blast;
+        for (auto& unit : target.units) {
+            if (unit.is_module()) continue;
+            Path dep = target.get_obj_path(unit);
+            dep.replace_extension(".d");
+            auto dep_info = parse_dep_file(dep);
+            if (!dep_info) {
+                log(WARN, "no dependency file for %s, build %s first.", unit.path.generic_string().c_str(), target.name.c_str());
+                continue;
+            }
+            auto   time    = times.find(unit.path.generic_string());
+            double seconds = time == times.end() ? 0 : time->second;
+            report.total_seconds += seconds;
+            report.units += 1;
+
+            std::set<string> opened;
+            string           source = unit.path.lexically_normal().generic_string();
+            for (auto& path : dep_info->depends) {
+                string header = path.lexically_normal().generic_string();
+                if (header != source) opened.insert(std::move(header));
+            }
+            for (auto& header : opened) {
+                auto [it, inserted] = index.try_emplace(header, paths.size());
+                if (inserted) {
+                    paths.emplace_back(header);
+                    including.push_back(0);
+                    blast.push_back(0);
+                }
+                including[it->second] += 1;
+                blast[it->second] += seconds;
+            }
+        }
+
+        // closures still valid from the last report, the rest are scanned concurrently
+        uint64_t                         flags   = target.compile_fingerprint(compiler);
+        auto                             cached  = load_closures(target.get_includes_path(), flags, stats);
+        OptionBlock                      options = target.get_option_block(compiler);
+        std::vector<std::vector<string>> closures(paths.size());
+        std::vector<size_t>              scanned;
+        std::vector<Task<CmdResult>>     scans;
+        for (size_t header = 0; header < paths.size(); ++header) {
+            auto it = cached.find(paths[header].generic_string());
+            if (it != cached.end()) {
+                closures[header] = std::move(it->second);
+                continue;
+            }
+            scanned.push_back(header);
+            scans.push_back(run(compiler.get_include_tree_cmd(paths[header], options)));
+        }
+        std::vector<CmdResult> results = co_await when_all(std::move(scans));
+        for (size_t i = 0; i < results.size(); ++i) {
+            size_t header = scanned[i];
+            if (!results[i].ok()) {
+                log(WARN, "could not scan the includes of %s.", paths[header].generic_string().c_str());
+                closures[header] = {paths[header].generic_string()};
+                continue;
+            }
+            closures[header] = parse_closure(paths[header], results[i].output);
+        }
+        if (!results.empty() && !save_closures(target.get_includes_path(), flags, paths, closures, stats)) {
+            log(WARN, "could not write %s.", target.get_includes_path().generic_string().c_str());
+        }
+
+        for (size_t header = 0; header < paths.size(); ++header) {
+            HeaderCost cost;
+            cost.path          = paths[header];
+            cost.bytes         = stats.get(cost.path).size;
+            cost.units         = including[header];
+            cost.blast_seconds = blast[header];
+            cost.closure_files = closures[header].size();
+            for (auto& file : closures[header]) { cost.closure_bytes += stats.get(file).size; }
+            report.headers.push_back(std::move(cost));
+        }
+
+        bool by_time = report.total_seconds > 0;
+        std::sort(report.headers.begin(), report.headers.end(), [by_time](const HeaderCost& a, const HeaderCost& b) {
+            if (by_time && a.blast_seconds != b.blast_seconds) return a.blast_seconds > b.blast_seconds;
+            if (a.parsed_bytes() != b.parsed_bytes()) return a.parsed_bytes() > b.parsed_bytes();
+            return a.path < b.path;
+        });
+        co_return report;
+    }
+
+    // the `limit` most expensive headers as a table on stdout, 0 prints all of them
+    void print(size_t limit = 20) const {
+        size_t count = limit ? std::min(limit, headers.size()) : headers.size();
+        char   line[512];
+        string content;
+        std::snprintf(line, sizeof(line), "%zu headers over %zu units", headers.size(), units);
+        content += line;
+        if (total_seconds > 0) {
+            std::snprintf(line, sizeof(line), ", %.2fs of recorded compile time", total_seconds);
+            content += line;
+        }
+        std::snprintf(line, sizeof(line), "\n%6s %10s %8s %13s %14s %10s  %s\n", "units", "bytes", "closure", "closure-bytes", "parsed-bytes", "blast", "header");
+        content += line;
+        for (size_t i = 0; i < count; ++i) {
+            const HeaderCost& cost = headers[i];
+            std::snprintf(line, sizeof(line), "%6zu %10llu %8zu %13llu %14llu", cost.units, (unsigned long long)cost.bytes, cost.closure_files,
+                          (unsigned long long)cost.closure_bytes, (unsigned long long)cost.parsed_bytes());
+            content += line;
+            if (total_seconds > 0) {
+                std::snprintf(line, sizeof(line), " %9.1f%%", 100 * cost.blast_seconds / total_seconds);
+            } else {
+                std::snprintf(line, sizeof(line), " %9.1f%%", units ? 100.0 * cost.units / units : 0.0);
+            }
+            content += line;
+            content += "  " + cost.path.generic_string() + "\n";
+        }
+        log_impl::write_record(1, content);
+    }
+
+    bool write_json(const Path& path) const {
+        string content = "{\"units\":" + std::to_string(units) + ",\"seconds\":" + std::to_string(total_seconds) + ",\"headers\":[";
+        for (size_t i = 0; i < headers.size(); ++i) {
+            const HeaderCost& cost = headers[i];
+            if (i > 0) content += ",";
+            content += "\n{\"path\":";
+            escape_json(content, cost.path.generic_string());
+            content += ",\"bytes\":" + std::to_string(cost.bytes);
+            content += ",\"units\":" + std::to_string(cost.units);
+            content += ",\"closure_files\":" + std::to_string(cost.closure_files);
+            content += ",\"closure_bytes\":" + std::to_string(cost.closure_bytes);
+            content += ",\"parsed_bytes\":" + std::to_string(cost.parsed_bytes());
+            content += ",\"blast_seconds\":" + std::to_string(cost.blast_seconds) + "}";
+        }
+        content += "\n]}\n";
+        return OS::write_file(path, content);
+    }
+
+private:
+    static Task<CmdResult> run(Cmd cmd) {
+        co_return co_await spawn(std::move(cmd));
+    }
+
+    // the header and every file its -H output opened, at any depth
+    static std::vector<string> parse_closure(const Path& header, string_view output) {
+        std::set<string> files = {header.generic_string()};
+        while (!output.empty()) {
+            size_t      end  = output.find('\n');
+            string_view line = output.substr(0, end);
+            output.remove_prefix(end == string_view::npos ? output.size() : end + 1);
+
+            // ". a.h", ".. b.h" for what a.h opened
+            size_t depth = line.find_first_not_of('.');
+            if (depth == 0 || depth == string_view::npos || line[depth] != ' ') continue;
+            line.remove_prefix(depth + 1);
+            while (!line.empty() && std::isspace((unsigned char)line.back())) line.remove_suffix(1);
+            if (!line.empty()) files.insert(Path(line).lexically_normal().generic_string());
+        }
+        return {files.begin(), files.end()};
+    }
+
+    // "fingerprint <hex>", then "h <header>" followed by "f <mtime> <file>" for its closure.
+    // a closure with a file changed since is dropped, so is everything from other flags
+    static std::unordered_map<string, std::vector<string>> load_closures(const Path& path, uint64_t flags, StatCache& stats) {
+        std::unordered_map<string, std::vector<string>> closures;
+        std::set<string>                                stale;
+        string                                          current;
+        bool                                            valid = false;
+        OS::read_lines(path, [&](string_view line) {
+            size_t      space = line.find(' ');
+            string_view kind  = line.substr(0, space);
+            string_view value = space == string_view::npos ? "" : line.substr(space + 1);
+            if (kind == "fingerprint") {
+                uint64_t hash = 0;
+                valid         = std::from_chars(value.data(), value.data() + value.size(), hash, 16).ec == std::errc() && hash == flags;
+            } else if (!valid) {
+                return;
+            } else if (kind == "h") {
+                current = value;
+                closures[current].clear();
+            } else if (kind == "f" && !current.empty()) {
+                size_t  next  = value.find(' ');
+                int64_t mtime = 0;
+                if (next == string_view::npos || std::from_chars(value.data(), value.data() + next, mtime).ec != std::errc()) {
+                    stale.insert(current);
+                    return;
+                }
+                string file(value.substr(next + 1));
+                if (stats.get(file).mtime != mtime) stale.insert(current);
+                closures[current].push_back(std::move(file));
+            }
+        });
+        for (auto& header : stale) { closures.erase(header); }
+        return closures;
+    }
+
+    static bool save_closures(const Path& path, uint64_t flags, const std::vector<Path>& headers, const std::vector<std::vector<string>>& closures, StatCache& stats) {
+        string content = "fingerprint ";
+        char   buffer[32];
+        content.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), flags, 16).ptr);
+        content += "\n";
+        for (size_t i = 0; i < headers.size(); ++i) {
+            content += "h " + headers[i].generic_string() + "\n";
+            for (auto& file : closures[i]) { content += "f " + std::to_string(stats.get(file).mtime) + " " + file + "\n"; }
+        }
+        return OS::write_file(path, content);
+    }
+};
+} // namespace build
+
+// compiles every unit concurrently on the event loop, then links
+inline Task<bool> build_target_async(ToolChain::Compiler& compiler, Target& target, StatCache* stats = nullptr) {
+    if (build::is_noop(compiler, target)) {
+        co_return true;
+    }
+    std::error_code ec;
+    std::filesystem::remove(target.get_manifest_path(), ec);
+
+    // objects from other flags are stale even when no source changed
+    uint64_t flags = target.compile_fingerprint(compiler);
+    auto     built = build::load_unit_flags(target.get_flags_path());
+
+    // jobs start in the order they are submitted
+    std::set<string>        failed  = build::load_failed_units(target.get_failed_path());
+    std::vector<size_t>     order   = build::schedule_units(target, failed, stats);
+    OptionBlock             options = target.get_option_block(compiler);
+    string                  tag     = target.variant_tag();
+    std::vector<Task<bool>> jobs;
+    jobs.reserve(target.units.size());
+    for (size_t i : order) {
+        Unit& unit    = target.units[i];
+        Dir   out_dir = target.get_obj_path(unit).parent_path();
+        auto  last    = built.find(unit.path.generic_string());
+        bool  force   = last == built.end() || last->second != flags;
+
+        jobs.push_back(build::compile_translation_unit_async(compiler, unit, out_dir, options, &target.graph, force, stats, tag));
+    }
+
+    std::vector<bool> results = co_await when_all(std::move(jobs));
+    build::record_compile_times(target);
+
+    // units that failed or were cancelled are forced again next time
+    bool flags_changed = false;
+    for (size_t i = 0; i < results.size(); ++i) {
+        string path = target.units[order[i]].path.generic_string();
+        auto   last = built.find(path);
+        if (results[i] && (last == built.end() || last->second != flags)) {
+            built[path]   = flags;
+            flags_changed = true;
+        } else if (!results[i] && last != built.end()) {
+            built.erase(last);
+            flags_changed = true;
+        }
+    }
+    if (flags_changed && !build::save_unit_flags(target.get_flags_path(), built)) {
+        log(WARN, "could not write %s.", target.get_flags_path().generic_string().c_str());
+    }
+
+    // a unit cancelled before it could fail again stays on the list
+    bool   success   = true;
+    size_t cancelled = 0;
+    string failures;
+    for (size_t i = 0; i < results.size(); ++i) {
+        Unit&  unit = target.units[order[i]];
+        string path = unit.path.generic_string();
+        if (results[i]) continue;
+        success = false;
+        if (unit.failed) {
+            log(ERRO, "compile %s%s failed.", path.c_str(), tag.c_str());
+        } else {
+            cancelled += 1;
+        }
+        if (unit.failed || failed.contains(path)) failures += path + "\n";
+    }
+    if (cancelled) {
+        log(WARN, "%zu compiles of %s%s cancelled.", cancelled, target.name.c_str(), tag.c_str());
+    }
+    if (failures.empty()) {
+        std::filesystem::remove(target.get_failed_path(), ec);
+    } else if (!OS::write_file(target.get_failed_path(), failures)) {
+        log(WARN, "could not write %s.", target.get_failed_path().generic_string().c_str());
+    }
+    if (!success) {
+        co_return false;
+    }
+
+    // an LTO link runs its backend on several cores, it takes that many job slots
+    size_t weight = target.lto == ToolChain::LTO::none ? 1 : target.get_lto_jobs();
+    if (target.lto != ToolChain::LTO::none) {
+        std::filesystem::create_directories(target.get_lto_cache_dir(), ec);
+    }
+    bool linked = co_await compiler.link_target_async(target.get_target_path(), target.obj_files(), target.get_link_options(compiler), target.debug_info, weight);
+    if (!linked) {
+        co_return false;
+    }
+    if (target.lto != ToolChain::LTO::none) {
+        build::prune_cache(target.get_lto_cache_dir(), target.lto_cache_size, target.lto_cache_age);
+    }
+    if (!build::write_manifest(compiler, target)) {
+        log(WARN, "could not write manifest of %s%s.", target.name.c_str(), target.variant_tag().c_str());
+    }
+    co_return true;
+}
+
+inline bool build_target(ToolChain::Compiler& compiler, Target& target) {
+    return sync_wait(build_target_async(compiler, target));
+}
+
+// every variant of every target feeds the same event loop, headers are stat'ed once for all of them
+inline Task<bool> build_targets_async(ToolChain::Compiler& compiler, std::vector<Target*> targets, std::vector<Target::Variant> fallback = {}) {
+    StatCache                                         stats;
+    std::vector<std::pair<Target, ToolChain::Compiler*>> builds;
+    std::vector<Target*>                              plain;
+    for (Target* target : targets) {
+        const auto& variants = target->variants.empty() ? fallback : target->variants;
+        if (variants.empty()) {
+            plain.push_back(target);
+            continue;
+        }
+        for (auto& variant : variants) {
+            builds.emplace_back(target->with_variant(variant), variant.compiler ? variant.compiler.get() : &compiler);
+        }
+    }
+
+    std::vector<Task<bool>> jobs;
+    jobs.reserve(plain.size() + builds.size());
+    for (Target* target : plain) { jobs.push_back(build_target_async(compiler, *target, &stats)); }
+    for (auto& [target, variant_compiler] : builds) { jobs.push_back(build_target_async(*variant_compiler, target, &stats)); }
+
+    std::vector<bool> results = co_await when_all(std::move(jobs));
+    bool              success = true;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i]) continue;
+        success = false;
+        if (i >= plain.size()) {
+            const Target& target = builds[i - plain.size()].first;
+            log(ERRO, "build %s%s failed.", target.name.c_str(), target.variant_tag().c_str());
         }
     }
+    co_return success;
+}
+
+inline bool build_variants(ToolChain::Compiler& compiler, Target& target) {
+    return sync_wait(build_targets_async(compiler, {&target}));
+}
 
-    return compiler.link_target(target.get_target_path(), target.obj_files());
+inline bool build_project(ToolChain::Compiler& compiler, Project& project) {
+    std::vector<Target*> targets;
+    for (auto& target : project.targets) { targets.push_back(&target); }
+    return sync_wait(build_targets_async(compiler, std::move(targets), project.variants));
 }
 
+struct TestResult {
+    string name;
+    Path   exe;
+    bool   passed  = false;
+    double seconds = 0;
+    string output;
+};
+
+// runs test executables concurrently on the event loop, failed and slow tests first
+class TestRunner {
+public:
+    // a gtest binary is split over at most this many processes, 0 means EventLoop::jobs
+    size_t shards       = 0;
+    Path   history_path = "build/.csc_test_history";
+
+    std::vector<TestResult> results;
+
+public:
+    void add(const string& name, const Path& exe, const std::vector<string>& args = {}) {
+        suites.push_back({name, exe, args, false});
+    }
+
+    void add(const Target& target, const std::vector<string>& args = {}) {
+        add(target.name, target.get_target_path(), args);
+    }
+
+    // every test listed by --gtest_list_tests is tracked and reported on its own
+    void add_gtest(const string& name, const Path& exe, const std::vector<string>& args = {}) {
+        suites.push_back({name, exe, args, true});
+    }
+
+    void add_gtest(const Target& target, const std::vector<string>& args = {}) {
+        add_gtest(target.name, target.get_target_path(), args);
+    }
+
+    Task<bool> run_async() {
+        results.clear();
+        load_history();
+
+        std::vector<Task<std::vector<string>>> listings;
+        for (auto& suite : suites) {
+            if (suite.gtest) listings.push_back(list_gtests(suite));
+        }
+        std::vector<std::vector<string>> listed = co_await when_all(std::move(listings));
+
+        std::vector<Batch> batches;
+        size_t             next = 0;
+        for (auto& suite : suites) {
+            if (!suite.gtest) {
+                Batch batch{&suite};
+                estimate(batch, suite.name);
+                batches.push_back(std::move(batch));
+            } else {
+                split(suite, listed[next++], batches);
+            }
+        }
+        std::stable_sort(batches.begin(), batches.end(), [](const Batch& a, const Batch& b) {
+            if (a.failed != b.failed) return a.failed;
+            return a.seconds > b.seconds;
+        });
+
+        std::vector<Task<std::vector<TestResult>>> jobs;
+        jobs.reserve(batches.size());
+        for (auto& batch : batches) { jobs.push_back(run_batch(std::move(batch))); }
+
+        bool success = std::all_of(results.begin(), results.end(), [](auto& r) { return r.passed; });
+        for (auto& batch : co_await when_all(std::move(jobs))) {
+            for (auto& result : batch) {
+                success = success && result.passed;
+                results.push_back(std::move(result));
+            }
+        }
+        save_history();
+
+        size_t failed = std::count_if(results.begin(), results.end(), [](auto& r) { return !r.passed; });
+        log(failed ? ERRO : INFO, "%zu tests, %zu failed.", results.size(), failed);
+        co_return success;
+    }
+
+    bool run() {
+        return sync_wait(run_async());
+    }
+
+    bool write_junit(const Path& path) const {
+        auto escape = [](string& out, string_view str) {
+            for (char c : str) {
+                switch (c) {
+                    case '<': out += "&lt;"; break;
+                    case '>': out += "&gt;"; break;
+                    case '&': out += "&amp;"; break;
+                    case '"': out += "&quot;"; break;
+                    default:
+                        if ((unsigned char)c >= 0x20 || c == '\n' || c == '\t') out.push_back(c);
+                }
+            }
+        };
+
+        std::vector<const TestResult*> sorted;
+        for (auto& result : results) { sorted.push_back(&result); }
+        std::stable_sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) { return a->exe < b->exe; });
+
+        string content = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n";
+        for (size_t i = 0; i < sorted.size();) {
+            size_t end      = i;
+            size_t failures = 0;
+            double seconds  = 0;
+            for (; end < sorted.size() && sorted[end]->exe == sorted[i]->exe; ++end) {
+                failures += !sorted[end]->passed;
+                seconds += sorted[end]->seconds;
+            }
+            content += "  <testsuite name=\"";
+            escape(content, sorted[i]->exe.generic_string());
+            content += "\" tests=\"" + std::to_string(end - i) + "\" failures=\"" + std::to_string(failures) + "\" time=\"" + std::to_string(seconds) + "\">\n";
+            for (; i < end; ++i) {
+                const TestResult& result = *sorted[i];
+                content += "    <testcase classname=\"";
+                escape(content, result.exe.generic_string());
+                content += "\" name=\"";
+                escape(content, result.name);
+                content += "\" time=\"" + std::to_string(result.seconds) + "\">";
+                content += result.passed ? "<system-out>" : "<failure message=\"failed\">";
+                escape(content, result.output);
+                content += result.passed ? "</system-out>" : "</failure>";
+                content += "</testcase>\n";
+            }
+            content += "  </testsuite>\n";
+        }
+        content += "</testsuites>\n";
+        return OS::write_file(path, content);
+    }
+
+    bool write_json(const Path& path) const {
+        string content = "{\"tests\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const TestResult& result = results[i];
+            if (i > 0) content += ",";
+            content += "\n{\"name\":";
+            escape_json(content, result.name);
+            content += ",\"exe\":";
+            escape_json(content, result.exe.generic_string());
+            content += ",\"passed\":";
+            content += result.passed ? "true" : "false";
+            content += ",\"seconds\":" + std::to_string(result.seconds) + ",\"output\":";
+            escape_json(content, result.output);
+            content += "}";
+        }
+        content += "\n]}\n";
+        return OS::write_file(path, content);
+    }
+
+private:
+    struct Suite {
+        string              name;
+        Path                exe;
+        std::vector<string> args;
+        bool                gtest;
+    };
+
+    struct History {
+        bool   failed  = false;
+        double seconds = 0;
+    };
+
+    // one process: a plain test, or a shard of gtest cases
+    struct Batch {
+        const Suite*        suite;
+        std::vector<string> tests;
+        bool                failed  = false;
+        double              seconds = 0;
+        size_t              bytes   = 0; // of its --gtest_filter
+        size_t              shard   = 0; // within its suite
+    };
+
+    std::vector<Suite>                  suites;
+    std::unordered_map<string, History> history;
+
+
+    void estimate(Batch& batch, const string& id) const {
+        auto it = history.find(id);
+        if (it == history.end()) return;
+        batch.failed = batch.failed || it->second.failed;
+        batch.seconds += it->second.seconds;
+    }
+
+    // longest processing time first, so one slow test does not end up in the last shard
+    void split(const Suite& suite, const std::vector<string>& tests, std::vector<Batch>& batches) const {
+        if (tests.empty()) return;
+        std::vector<Batch> cases;
+        for (auto& test : tests) {
+            Batch one{&suite, {test}};
+            estimate(one, suite.name + "/" + test);
+            cases.push_back(std::move(one));
+        }
+        std::stable_sort(cases.begin(), cases.end(), [](const Batch& a, const Batch& b) {
+            if (a.failed != b.failed) return a.failed;
+            return a.seconds > b.seconds;
+        });
+
+        // a shard whose filter would not fit into one argument gets split further
+        size_t             count = std::min(tests.size(), shards ? shards : EventLoop::current().jobs);
+        size_t             limit = filter_limit(suite);
+        std::vector<Batch> shard(std::max<size_t>(count, 1), Batch{&suite});
+        for (auto& one : cases) {
+            size_t need = one.tests.front().size() + 1;
+            auto   it   = shard.end();
+            for (auto candidate = shard.begin(); candidate != shard.end(); ++candidate) {
+                if (candidate->bytes + need > limit && !candidate->tests.empty()) continue;
+                if (it == shard.end() || candidate->seconds < it->seconds ||
+                    (candidate->seconds == it->seconds && candidate->tests.size() < it->tests.size())) {
+                    it = candidate;
+                }
+            }
+            if (it == shard.end()) {
+                shard.push_back(Batch{&suite});
+                it = shard.end() - 1;
+            }
+            it->bytes += need;
+            it->tests.push_back(one.tests.front());
+            it->failed = it->failed || one.failed;
+            it->seconds += one.seconds;
+        }
+        for (size_t i = 0; i < shard.size(); ++i) {
+            shard[i].shard = i;
+            if (!shard[i].tests.empty()) batches.push_back(std::move(shard[i]));
+        }
+    }
+
+    // bytes of test names one --gtest_filter argument can hold besides the rest of the command
+    static size_t filter_limit(const Suite& suite) {
+        size_t used = suite.exe.native().size() + 64; // option names and separators
+        for (auto& arg : suite.args) { used += arg.size() + 1 + sizeof(char*); }
+        size_t limit = std::min(OS::arg_strlen_max - 1, OS::arg_max());
+        return limit > used ? limit - used : 1;
+    }
+
+    Task<std::vector<string>> list_gtests(const Suite& suite) {
+        CmdResult result = co_await spawn(Cmd(suite.exe, suite.args, "--gtest_list_tests"));
+        if (!result.ok()) {
+            log(ERRO, "could not list tests of %s.", suite.exe.generic_string().c_str());
+            results.push_back({suite.name, suite.exe, false, result.seconds, std::move(result.output)});
+            co_return std::vector<string>{};
+        }
+
+        // "Suite.\n  Test  # GetParam() = 1\n"
+        std::vector<string> tests;
+        string              prefix;
+        string_view         data = result.output;
+        while (!data.empty()) {
+            size_t      end  = data.find('\n');
+            string_view line = data.substr(0, end);
+            data.remove_prefix(end == string_view::npos ? data.size() : end + 1);
+
+            bool indented = !line.empty() && line.front() == ' ';
+            line          = line.substr(0, line.find('#'));
+            while (!line.empty() && std::isspace((unsigned char)line.front())) line.remove_prefix(1);
+            while (!line.empty() && std::isspace((unsigned char)line.back())) line.remove_suffix(1);
+            if (line.empty()) continue;
+
+            if (!indented) {
+                prefix = line;
+            } else if (!prefix.empty() && !line.starts_with("DISABLED_") && !prefix.starts_with("DISABLED_")) {
+                tests.push_back(prefix + string(line));
+            }
+        }
+        co_return tests;
+    }
+
+    Task<std::vector<TestResult>> run_batch(Batch batch) {
+        const Suite& suite = *batch.suite;
+        Cmd          cmd(suite.exe, suite.args);
+        if (suite.gtest) {
+            string filter = "--gtest_filter=";
+            for (size_t i = 0; i < batch.tests.size(); ++i) {
+                if (i > 0) filter += ":";
+                filter += batch.tests[i];
+            }
+            cmd.Append(filter, "--gtest_color=no");
+        }
+        CmdResult result = co_await spawn(std::move(cmd));
+
+        std::vector<TestResult> tests;
+        if (!suite.gtest) {
+            tests.push_back({suite.name, suite.exe, result.ok(), result.seconds, std::move(result.output)});
+        } else {
+            tests = parse_gtest_output(suite, batch.tests, batch.shard, result);
+        }
+        for (auto& test : tests) {
+            if (test.passed) {
+                log(INFO, "PASS %s (%.2fs)", test.name.c_str(), test.seconds);
+            } else {
+                string_view output = test.output;
+                if (output.ends_with('\n')) output.remove_suffix(1);
+                log(ERRO, "FAIL %s (%.2fs)%s%.*s", test.name.c_str(), test.seconds, output.empty() ? "" : "\n", int(output.size()), output.data());
+            }
+        }
+        co_return tests;
+    }
+
+    // split a shard's output at "[ RUN      ]" lines, a test that never reports crashed the shard.
+    // a shard that fails after all of its tests passed is reported as "<suite>/shard-<n>"
+    static std::vector<TestResult> parse_gtest_output(const Suite& suite, const std::vector<string>& names, size_t shard, const CmdResult& result) {
+        std::unordered_map<string_view, size_t> index;
+        std::vector<TestResult>                 tests;
+        std::vector<bool>                       reported(names.size(), false);
+        for (size_t i = 0; i < names.size(); ++i) {
+            index.emplace(names[i], i);
+            tests.push_back({suite.name + "/" + names[i], suite.exe, false, 0, ""});
+        }
+
+        auto test_of = [&](string_view line) -> TestResult* {
+            line = line.substr(line.find(']') + 1);
+            while (!line.empty() && std::isspace((unsigned char)line.front())) line.remove_prefix(1);
+            while (!line.empty() && std::isspace((unsigned char)line.back())) line.remove_suffix(1);
+            auto it = index.find(line.substr(0, line.find(' ')));
+            return it == index.end() ? nullptr : &tests[it->second];
+        };
+        auto millis = [](string_view line) {
+            size_t open = line.rfind('(');
+            double ms   = 0;
+            if (open != string_view::npos) std::from_chars(line.data() + open + 1, line.data() + line.size(), ms);
+            return ms / 1000;
+        };
+
+        // output after the last test: leak reports, global tear-down, static destructors
+        TestResult* current  = nullptr;
+        string      trailing;
+        string_view data     = result.output;
+        while (!data.empty()) {
+            size_t      end  = data.find('\n');
+            string_view line = data.substr(0, end == string_view::npos ? data.size() : end + 1);
+            data.remove_prefix(line.size());
+
+            if (line.starts_with("[ RUN      ]")) {
+                current = test_of(line);
+                trailing.clear();
+            } else if (current && (line.starts_with("[       OK ]") || line.starts_with("[  FAILED  ]") || line.starts_with("[  SKIPPED ]"))) {
+                current->passed  = !line.starts_with("[  FAILED  ]");
+                current->seconds = millis(line);
+                reported[current - tests.data()] = true;
+                current->output.append(line);
+                current = nullptr;
+                continue;
+            }
+            if (current) {
+                current->output.append(line);
+            } else {
+                trailing.append(line);
+            }
+        }
+
+        bool blamed = false;
+        for (size_t i = 0; i < tests.size(); ++i) {
+            if (reported[i]) continue;
+            tests[i].passed = false;
+            if (!blamed) tests[i].output += trailing;
+            tests[i].output += tests[i].output.empty() ? "not run, the shard exited early\n" : "crashed\n";
+            tests[i].output += "exit status " + std::to_string(result.status) + "\n";
+            blamed = true;
+        }
+        bool passed = std::all_of(tests.begin(), tests.end(), [](auto& test) { return test.passed; });
+        if (passed && !result.ok()) {
+            tests.push_back({suite.name + "/shard-" + std::to_string(shard), suite.exe, false, result.seconds, std::move(trailing)});
+            tests.back().output += "exit status " + std::to_string(result.status) + " after every test passed\n";
+        }
+        return tests;
+    }
+
+    void load_history() {
+        history.clear();
+
+        // "<failed> <seconds> <name>"
+        OS::read_lines(history_path, [&](string_view line) {
+            size_t first  = line.find(' ');
+            size_t second = line.find(' ', first + 1);
+            if (first == string_view::npos || second == string_view::npos) return;
+
+            History entry;
+            entry.failed = line.substr(0, first) == "1";
+            std::from_chars(line.data() + first + 1, line.data() + second, entry.seconds);
+            history[string(line.substr(second + 1))] = entry;
+        });
+    }
+
+    void save_history() {
+        for (auto& result : results) {
+            history[result.name] = {!result.passed, result.seconds};
+        }
+        string content;
+        for (auto& [name, entry] : history) {
+            content += entry.failed ? "1 " : "0 ";
+            content += std::to_string(entry.seconds) + " " + name + "\n";
+        }
+        if (!OS::write_file(history_path, content)) {
+            log(WARN, "could not write test history %s.", history_path.generic_string().c_str());
+        }
+    }
+};
+
 inline void update_self(int argc, char** argv, const Path& source, const std::vector<Path>& others = {}) {
     auto result = build::update_self(argc, argv, source, others);
     if (!result) {
@@ -0,0 +1,36 @@
+#include "../../csc.hpp"
+
+using namespace csc;
+using namespace csc::ToolChain;
+
+Task<bool> generate_answer() {
+    CmdResult result = co_await spawn(Cmd("sh", "-c", "echo 'int get_answer() { return 42; }' > answer.cpp"));
+    co_return result.ok();
+}
+
+Task<bool> compile_main() {
+    CmdResult result = co_await spawn(Cmd("clang++", "-std=c++23", "-c", "main.cpp", "-o", "main.o"));
+    if (!result.ok()) log(ERRO, "%s", result.output.c_str());
+    co_return result.ok();
+}
+
+Task<bool> pipeline() {
+    auto [generated, compiled] = co_await when_all(generate_answer(), compile_main());
+    if (!generated || !compiled) co_return false;
+
+    CmdResult answer = co_await spawn(Cmd("clang++", "-std=c++23", "-c", "answer.cpp", "-o", "answer.o"));
+    if (!answer.ok()) co_return false;
+
+    CmdResult link = co_await spawn(Cmd("clang++", "main.o", "answer.o", "-o", "main"));
+    co_return link.ok();
+}
+
+int main(int argc, char* argv[]) {
+    update_self(argc, argv, __FILE__, {"../../csc.hpp"});
+
+    if (sync_wait(pipeline())) {
+        log(INFO, "build target success");
+    } else {
+        log(ERRO, "build target failed");
+    }
+}
@@ -0,0 +1,8 @@
+#include <iostream>
+
+int get_answer();
+
+int main(int argc, char* argv[]) {
+    std::cout << get_answer() << "\n";
+    return 0;
+}
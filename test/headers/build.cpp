@@ -0,0 +1,21 @@
+#include "../../csc.hpp"
+
+using namespace csc;
+using namespace csc::ToolChain;
+
+int main(int argc, char* argv[]) {
+    update_self(argc, argv, __FILE__, {"../../csc.hpp"});
+
+    Target target("main");
+    target.add_translation_units({Unit("main.cpp"), Unit("shape.cpp")});
+
+    Clang clang;
+    if (!build_target(clang, target)) {
+        log(ERRO, "build main failed");
+        return 1;
+    }
+
+    auto report = build::HeaderReport::analyze(clang, target);
+    report.print(10);
+    report.write_json(target.build / "headers.json");
+}
@@ -0,0 +1,9 @@
+#include <iostream>
+
+#include "shape.hpp"
+
+int main(int argc, char* argv[]) {
+    Shape square{"square", {1, 1, 1, 1}};
+    std::cout << square.name << ": " << area(square) << "\n";
+    return 0;
+}
@@ -0,0 +1,7 @@
+#include "shape.hpp"
+
+double area(const Shape& shape) {
+    double sum = 0;
+    for (double point : shape.points) { sum += point; }
+    return sum;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct Shape {
+    std::string         name;
+    std::vector<double> points;
+};
+
+double area(const Shape& shape);
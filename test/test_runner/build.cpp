@@ -0,0 +1,32 @@
+#include "../../csc.hpp"
+
+using namespace csc;
+using namespace csc::ToolChain;
+
+int main(int argc, char* argv[]) {
+    update_self(argc, argv, __FILE__, {"../../csc.hpp"});
+
+    Target target("fake_gtest");
+    target.add_translation_units({Unit("fake_gtest.cpp")});
+
+    Clang clang;
+    if (!build_target(clang, target)) {
+        log(ERRO, "build fake_gtest failed");
+        return 1;
+    }
+
+    // every test reports OK, the leak at exit still has to fail the run
+    TestRunner runner;
+    runner.shards = 1;
+    runner.add_gtest("clean", target.get_target_path());
+    runner.add_gtest("leaky", target.get_target_path(), {"--leak"});
+    bool passed = runner.run();
+
+    auto shard = std::find_if(runner.results.begin(), runner.results.end(), [](auto& r) { return r.name == "leaky/shard-0"; });
+    if (!passed && shard != runner.results.end() && shard->output.find("LeakSanitizer") != string::npos) {
+        log(INFO, "test runner success");
+    } else {
+        log(ERRO, "test runner failed");
+        return 1;
+    }
+}
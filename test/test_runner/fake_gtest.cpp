@@ -0,0 +1,30 @@
+// prints what a gtest binary would, with --leak every test passes and the process still fails
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+int main(int argc, char* argv[]) {
+    bool        leak   = false;
+    const char* filter = "";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--gtest_list_tests") == 0) {
+            std::printf("Math.\n  Add\n  Sub\n");
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--leak") == 0) leak = true;
+        if (std::strncmp(argv[i], "--gtest_filter=", 15) == 0) filter = argv[i] + 15;
+    }
+
+    std::string tests = filter;
+    for (size_t begin = 0; begin < tests.size();) {
+        size_t      end  = tests.find(':', begin);
+        std::string name = tests.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        std::printf("[ RUN      ] %s\n[       OK ] %s (0 ms)\n", name.c_str(), name.c_str());
+        begin = end == std::string::npos ? tests.size() : end + 1;
+    }
+    if (leak) {
+        std::printf("==1==ERROR: LeakSanitizer: detected memory leaks\n");
+        return 23;
+    }
+    return 0;
+}
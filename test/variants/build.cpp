@@ -0,0 +1,23 @@
+#include "../../csc.hpp"
+
+using namespace csc;
+using namespace csc::ToolChain;
+
+int main(int argc, char* argv[]) {
+    update_self(argc, argv, __FILE__, {"../../csc.hpp"});
+
+    Target target("main");
+    target.add_translation_units({Unit("main.cpp")});
+    target.add_variant(Target::Variant::debug());
+    target.add_variant(Target::Variant::release());
+    target.add_variant(Target::Variant::asan());
+
+    Clang clang;
+    bool  result = build_variants(clang, target);
+
+    if (result) {
+        log(INFO, "build variants success");
+    } else {
+        log(ERRO, "build variants failed");
+    }
+}
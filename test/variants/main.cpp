@@ -0,0 +1,10 @@
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+#ifdef NDEBUG
+    std::cout << "release\n";
+#else
+    std::cout << "debug\n";
+#endif
+    return 0;
+}